@@ -0,0 +1,212 @@
+#include <bits/stdc++.h>
+#include "node.h"
+#include "locality.h"
+#include "zone_config.h"
+
+using namespace std;
+
+#ifndef CRDB_REPLICATION_LAYER_ALLOCATOR_H
+#define CRDB_REPLICATION_LAYER_ALLOCATOR_H
+
+// Minimum difference in fullness between the most and least full candidates for the allocator to move a replica.
+const double ALLOCATOR_REBALANCE_MARGIN = 0.5;
+
+// What the allocator knows about each node when deciding where to place replicas.
+struct StoreDescriptor {
+    int node_id;
+    int range_count = 0;
+    // Number of keys stored, as a stand-in for disk usage.
+    int disk_usage = 0;
+    // Requests served as leaseholder during the current tick.
+    int load = 0;
+    Locality locality;
+    // Decommissioning nodes never receive new replicas, and their replicas are moved elsewhere first.
+    bool decommissioning = false;
+    // Nodes that are not live don't receive new replicas either.
+    bool live = true;
+};
+
+// Keys of a single Range, used to estimate how the stores would look like after moving one of its replicas.
+struct RangeUsage {
+    int keys = 0;
+};
+
+// Chooses on which nodes the replicas of a Range should live. Candidates are compared first by diversity (how
+// independently from the other replicas of the Range they would fail, given their localities) and then by fullness,
+// which combines range count, disk usage and load relative to the cluster mean, so that every node converges to the
+// same share of each of them.
+class Allocator {
+    map<int, StoreDescriptor> stores_;
+    // If false, localities are ignored and every node is considered its own failure domain.
+    bool locality_aware_;
+    double mean_range_count_ = 0;
+    double mean_disk_usage_ = 0;
+    double mean_load_ = 0;
+
+    static double Ratio(double value, double mean) {
+        return mean == 0 ? 0 : value / mean;
+    }
+
+    [[nodiscard]] double Fullness(const StoreDescriptor &store) const {
+        return Ratio(store.range_count, mean_range_count_) + Ratio(store.disk_usage, mean_disk_usage_) +
+               Ratio(store.load, mean_load_);
+    }
+
+    // Mean diversity between the node and the given replicas (excluding the node itself), from 0 (same zone as all of
+    // them) to 1 (different region than all of them).
+    [[nodiscard]] double Diversity(int node_id, const set<int> &replicas_id) const {
+        double diversity = 0;
+        int others = 0;
+        for (auto replica_id : replicas_id) {
+            if (replica_id == node_id) continue;
+            others++;
+            if (!locality_aware_) diversity += 1;
+            else diversity += LocalityDiversity(stores_.at(node_id).locality, stores_.at(replica_id).locality);
+        }
+        return others == 0 ? 1 : diversity / others;
+    }
+
+    // Returns true if replica_id should be removed before worst_id, being less diverse or, if they are as diverse, fuller.
+    [[nodiscard]] bool IsWorseReplica(int replica_id, int worst_id, const set<int> &replicas_id) const {
+        if (worst_id < 0) return true;
+        double diversity = Diversity(replica_id, replicas_id);
+        double worst_diversity = Diversity(worst_id, replicas_id);
+        if (abs(diversity - worst_diversity) > 1e-9) return diversity < worst_diversity;
+        return Fullness(stores_.at(replica_id)) > Fullness(stores_.at(worst_id));
+    }
+
+    // Returns true if candidate_id is a better place for a replica than best_id.
+    [[nodiscard]] bool IsBetterCandidate(int candidate_id, int best_id, const set<int> &replicas_id) const {
+        if (best_id < 0) return true;
+        double candidate_diversity = Diversity(candidate_id, replicas_id);
+        double best_diversity = Diversity(best_id, replicas_id);
+        if (abs(candidate_diversity - best_diversity) > 1e-9) return candidate_diversity > best_diversity;
+        return Fullness(stores_.at(candidate_id)) < Fullness(stores_.at(best_id));
+    }
+
+public:
+    explicit Allocator(const map<int, StoreDescriptor> &stores, bool locality_aware = true)
+            : stores_{stores}, locality_aware_{locality_aware} {
+        for (const auto &[_, store] : stores_) {
+            mean_range_count_ += store.range_count;
+            mean_disk_usage_ += store.disk_usage;
+            mean_load_ += store.load;
+        }
+        if (stores_.empty()) return;
+        mean_range_count_ /= (double) stores_.size();
+        mean_disk_usage_ /= (double) stores_.size();
+        mean_load_ /= (double) stores_.size();
+    }
+
+    // Best node satisfying the constraints to add a new replica of a Range with the given replicas, or -1 if there is
+    // none left. Nodes in excluded_id (e.g. those with a replica of a different kind) are never chosen.
+    [[nodiscard]] int AllocateTarget(const set<int> &replicas_id, const vector<Constraint> &constraints = {},
+                                     const set<int> &excluded_id = {}) const {
+        int best_id = -1;
+        for (const auto &[node_id, store] : stores_) {
+            if (replicas_id.contains(node_id) || excluded_id.contains(node_id)) continue;
+            if (store.decommissioning || !store.live) continue;
+            if (!SatisfiesConstraints(store.locality, constraints)) continue;
+            if (IsBetterCandidate(node_id, best_id, replicas_id)) best_id = node_id;
+        }
+        return best_id;
+    }
+
+    // Replica that should be removed from the Range (one on a decommissioning node or violating the constraints, or
+    // else the least diverse one and then the fullest one), or -1 if there is none. The leader and the leaseholder are
+    // never removed, since that would require moving their roles first, and neither are replicas on nodes where the
+    // lease is preferred to be.
+    [[nodiscard]] int RemoveTarget(const RangeDescriptor &descriptor, const vector<Constraint> &constraints = {}) const {
+        const auto &preferences = descriptor.lease_preferences;
+        int worst_id = -1;
+        for (auto replica_id : descriptor.replicas_id) {
+            if (replica_id == descriptor.leader_id || replica_id == descriptor.leaseholder_id) continue;
+            const auto &store = stores_.at(replica_id);
+            if (store.decommissioning || !SatisfiesConstraints(store.locality, constraints)) return replica_id;
+            if (find(preferences.begin(), preferences.end(), replica_id) != preferences.end()) continue;
+            if (IsWorseReplica(replica_id, worst_id, descriptor.replicas_id)) worst_id = replica_id;
+        }
+        return worst_id;
+    }
+
+    // Non-voting replica that should be removed from the Range, chosen like RemoveTarget does but considering the
+    // diversity with respect to every replica of the Range, or -1 if there is none.
+    [[nodiscard]] int RemoveNonVoterTarget(const RangeDescriptor &descriptor,
+                                           const vector<Constraint> &constraints = {}) const {
+        auto replicas_id = descriptor.replicas_id;
+        replicas_id.insert(descriptor.non_voters_id.begin(), descriptor.non_voters_id.end());
+        int worst_id = -1;
+        for (auto replica_id : descriptor.non_voters_id) {
+            const auto &store = stores_.at(replica_id);
+            if (store.decommissioning || !SatisfiesConstraints(store.locality, constraints)) return replica_id;
+            if (IsWorseReplica(replica_id, worst_id, replicas_id)) worst_id = replica_id;
+        }
+        return worst_id;
+    }
+
+    // Returns the (node to remove, node to add) pair that moves a non-voting replica off a decommissioning node or a
+    // node that violates the constraints, or to a node that makes the Range more diverse, or (-1, -1) if there is no
+    // such move. Non-voting replicas are not moved for balance, since they don't hold leases.
+    [[nodiscard]] pair<int, int> RebalanceNonVoterTarget(const RangeDescriptor &descriptor,
+                                                         const vector<Constraint> &constraints = {}) const {
+        int remove_id = RemoveNonVoterTarget(descriptor, constraints);
+        if (remove_id < 0) return {-1, -1};
+        auto replicas_id = descriptor.replicas_id;
+        replicas_id.insert(descriptor.non_voters_id.begin(), descriptor.non_voters_id.end());
+        replicas_id.erase(remove_id);
+        int add_id = AllocateTarget(replicas_id, constraints, {remove_id});
+        if (add_id < 0) return {-1, -1};
+
+        const auto &source = stores_.at(remove_id);
+        if (source.decommissioning || !SatisfiesConstraints(source.locality, constraints)) return {remove_id, add_id};
+        if (Diversity(add_id, replicas_id) > Diversity(remove_id, replicas_id) + 1e-9) return {remove_id, add_id};
+        return {-1, -1};
+    }
+
+    // Returns the (node to remove, node to add) pair that would improve the balance of the cluster the most by moving a
+    // replica of the Range, or (-1, -1) if the difference in fullness is not worth the move. The move must not leave
+    // the new node fuller than the old one was, since that would only make the replica move back and forth. Replicas
+    // on decommissioning nodes or violating the constraints are always moved, replicas are moved whenever that makes
+    // the Range more diverse, and never when that makes it less diverse.
+    [[nodiscard]] pair<int, int> RebalanceTarget(const RangeDescriptor &descriptor, const RangeUsage &usage,
+                                                 const vector<Constraint> &constraints = {}) const {
+        int remove_id = RemoveTarget(descriptor, constraints);
+        if (remove_id < 0) return {-1, -1};
+        auto remaining_replicas_id = descriptor.replicas_id;
+        remaining_replicas_id.erase(remove_id);
+        int add_id = AllocateTarget(remaining_replicas_id, constraints, descriptor.non_voters_id);
+        if (add_id < 0 || add_id == remove_id) return {-1, -1};
+
+        auto source = stores_.at(remove_id);
+        auto target = stores_.at(add_id);
+        if (source.decommissioning || !SatisfiesConstraints(source.locality, constraints)) return {remove_id, add_id};
+        double source_diversity = Diversity(remove_id, remaining_replicas_id);
+        double target_diversity = Diversity(add_id, remaining_replicas_id);
+        if (target_diversity > source_diversity + 1e-9) return {remove_id, add_id};
+        if (target_diversity < source_diversity - 1e-9) return {-1, -1};
+        if (Fullness(source) - Fullness(target) < ALLOCATOR_REBALANCE_MARGIN) return {-1, -1};
+
+        source.range_count--;
+        source.disk_usage -= usage.keys;
+        target.range_count++;
+        target.disk_usage += usage.keys;
+        if (Fullness(target) > Fullness(source)) return {-1, -1};
+
+        return {remove_id, add_id};
+    }
+
+    // Records that a replica of a Range was removed from remove_id and/or added to add_id (-1 if none), so that later
+    // decisions take it into account.
+    void RecordMove(int remove_id, int add_id, const RangeUsage &usage) {
+        if (stores_.contains(remove_id)) {
+            stores_[remove_id].range_count--;
+            stores_[remove_id].disk_usage -= usage.keys;
+        }
+        if (stores_.contains(add_id)) {
+            stores_[add_id].range_count++;
+            stores_[add_id].disk_usage += usage.keys;
+        }
+    }
+};
+
+#endif //CRDB_REPLICATION_LAYER_ALLOCATOR_H
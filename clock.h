@@ -0,0 +1,21 @@
+#ifndef CRDB_REPLICATION_LAYER_CLOCK_H
+#define CRDB_REPLICATION_LAYER_CLOCK_H
+
+// Milliseconds of simulated time that pass with every tick.
+const double TICK_DURATION_MS = 500;
+
+// Simulated time, measured in ticks. It only moves forward when the DistributionLayer ticks.
+class SimulatedClock {
+    long long now_ = 0;
+
+public:
+    [[nodiscard]] long long Now() const {
+        return now_;
+    }
+
+    void Advance() {
+        now_++;
+    }
+};
+
+#endif //CRDB_REPLICATION_LAYER_CLOCK_H
@@ -0,0 +1,39 @@
+#ifndef CRDB_REPLICATION_LAYER_CLUSTER_SETTINGS_H
+#define CRDB_REPLICATION_LAYER_CLUSTER_SETTINGS_H
+
+// Settings that can be changed while the cluster is running, e.g. to compare the behavior of the cluster with and
+// without some mechanism in a benchmark. Every mechanism is enabled by default.
+struct ClusterSettings {
+    // Split Ranges that receive too many requests (see RunSplitQueue).
+    bool load_based_splitting = true;
+    // Merge adjacent Ranges that are small and cold (see RunMergeQueue).
+    bool range_merging = true;
+    // Move leases from overloaded nodes to underloaded ones (see RunLeaseRebalancer).
+    bool lease_rebalancing = true;
+    // Add, remove and move replicas so that every Range has the right number of them and nodes stay balanced (see
+    // RunReplicateQueue).
+    bool replica_rebalancing = true;
+    // Keep the lease and the Raft leadership of every Range on the same node, so that the leaseholder doesn't have to
+    // forward commands to a different node. Leadership follows the lease whenever it is transferred.
+    bool colocate_leaseholder_and_leader = true;
+    // Let the outgoing leaseholder hand the lease over to the incoming one, which can then serve right away, instead of
+    // making the incoming leaseholder wait until the outgoing one can no longer be serving (see TransferLease).
+    bool cooperative_lease_transfers = true;
+    // Move the lease of a Range to the replica on the node through which most of its requests arrive (see
+    // RunLeasePlacement).
+    bool follow_the_workload = true;
+    // Spread the replicas of every Range across as many regions and zones as possible. Otherwise, every node is
+    // considered its own failure domain.
+    bool locality_aware_allocation = true;
+    // Commit transactions whose writes all fall in the same Range as a single replicated batch, without writing intents
+    // nor a transaction record (see Node::EndTransaction).
+    bool one_phase_commit = true;
+    // Commit transactions that span several Ranges by proving their pipelined writes in parallel with a STAGING record,
+    // so that committing takes a single round of consensus (see Node::ParallelCommit).
+    bool parallel_commits = true;
+    // Answer the writes of a transaction as soon as they are proposed, and only check that they were replicated when
+    // the transaction commits or touches their keys again (see Node::WriteIntent).
+    bool write_pipelining = true;
+};
+
+#endif //CRDB_REPLICATION_LAYER_CLUSTER_SETTINGS_H
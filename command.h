@@ -2,6 +2,8 @@
 // Created by armandouv on 30/12/22.
 //
 
+#include "hlc.h"
+
 #ifndef CRDB_REPLICATION_LAYER_COMMAND_H
 #define CRDB_REPLICATION_LAYER_COMMAND_H
 
@@ -9,15 +11,81 @@ enum OpType {
     CREATE,
     READ,
     UPDATE,
-    DELETE
+    DELETE,
+    // Writes the record of a transaction with its final status.
+    END_TRANSACTION,
+    // Turns the intent of a transaction on the key into a regular value if the transaction committed, or discards it
+    // if it aborted.
+    RESOLVE_INTENT,
+    // Applies every write of a transaction at once, committing it in a single round.
+    ONE_PHASE_COMMIT,
+    // Checks, at the leaseholder, that the key has an intent of the transaction, and prevents it from being written
+    // later otherwise.
+    QUERY_INTENT,
+    // Aborts a transaction that holds a lock someone is waiting for, or pushes it to commit above a timestamp.
+    PUSH_TRANSACTION,
+    // Reads every key in [key, value] that exists at the timestamp of the command. Scans are not replicated, and they
+    // must fall inside a single Range.
+    SCAN,
+    // Read-modify-write operations, which the leaseholder evaluates against the current value of the key and replicates
+    // as the CREATE or UPDATE they result in. CONDITIONAL_PUT writes value if the key has expected_value, INCREMENT
+    // adds value to the key (which starts at 0 if it doesn't exist), and PUT_IF_ABSENT writes value if the key doesn't
+    // exist.
+    CONDITIONAL_PUT,
+    INCREMENT,
+    PUT_IF_ABSENT
+};
+
+enum TransactionStatus {
+    PENDING,
+    // The transaction is committed once all of the intents listed in its record are written (see parallel commits).
+    STAGING,
+    COMMITTED,
+    ABORTED
 };
 
+// Returns true for the operations that change the value of their key.
+bool IsWrite(OpType type) {
+    return type == CREATE || type == UPDATE || type == DELETE;
+}
+
+// Returns true for the operations that are evaluated by the leaseholder before being replicated as a plain write.
+bool IsReadModifyWrite(OpType type) {
+    return type == CONDITIONAL_PUT || type == INCREMENT || type == PUT_IF_ABSENT;
+}
+
+// Returns true for the operations that only read.
+bool IsRead(OpType type) {
+    return type == READ || type == SCAN;
+}
+
 // A Command is a sequence of low-level changes to be applied to the underlying key-value store.
 // For simplicity's sake, here we only consider a single change.
 struct Command {
     OpType type;
     int key;
     int value;
+    // Timestamp at which the command is evaluated. The node that first receives a command without one stamps it with
+    // its hybrid logical clock (or the leaseholder, for reads outside of a transaction), and reads can be given an
+    // older one to read the values as of that timestamp.
+    Timestamp timestamp = 0;
+    // Index in the Raft log of the Range, assigned by the leader when the command is proposed.
+    long long index = 0;
+    // Transaction the command belongs to (0 if none). Writes of a transaction leave an intent instead of a value.
+    long long transaction_id = 0;
+    // Final status of the transaction, for END_TRANSACTION and RESOLVE_INTENT (PENDING to only move the intent to the
+    // timestamp of the command). For PUSH_TRANSACTION, ABORTED to abort the transaction and PENDING to push it.
+    TransactionStatus transaction_status = PENDING;
+    // Anchor key of the transaction, for its writes, so that whoever finds their intents can find its record.
+    int anchor_key = -1;
+    // Keys with an intent of the transaction, for END_TRANSACTION.
+    set<int> intent_keys;
+    // Writes of the transaction, in order, for ONE_PHASE_COMMIT.
+    vector<Command> writes;
+    // The leaseholder answers as soon as the command is proposed, without waiting for it to be replicated.
+    bool async_consensus = false;
+    // Value the key must have for a CONDITIONAL_PUT to be written.
+    int expected_value = 0;
 };
 
 #endif //CRDB_REPLICATION_LAYER_COMMAND_H
@@ -4,10 +4,32 @@
 
 #include <bits/stdc++.h>
 #include "node.h"
+#include "allocator.h"
+#include "cluster_settings.h"
+#include "zone_config.h"
 
 using namespace std;
 
 int MAX_KEY = 100;
+// Number of client operations after which the simulated clock ticks and the background queues run.
+int OPERATIONS_PER_TICK = 10;
+// Number of requests per tick above which a Range is considered hot and is split by load.
+int LOAD_SPLIT_THRESHOLD = 8;
+// Two adjacent Ranges are merged when together they hold at most this number of keys and receive fewer than
+// MERGE_LOAD_THRESHOLD requests per tick. The load threshold is below the split one so that merged Ranges are not split
+// right away.
+int MERGE_SIZE_THRESHOLD = 4;
+int MERGE_LOAD_THRESHOLD = LOAD_SPLIT_THRESHOLD / 2;
+// A node is overloaded when it serves more than (1 + LEASE_REBALANCE_THRESHOLD) times the mean number of requests per
+// node as leaseholder.
+double LEASE_REBALANCE_THRESHOLD = 0.1;
+// Number of requests a node can serve as leaseholder per unit of simulated time.
+int NODE_CAPACITY = 10;
+// With follow-the-workload, the lease of a Range is moved to the replica that minimizes the latency from the gateways
+// of its recent requests, as long as that reduces it by at least FOLLOW_THE_WORKLOAD_MIN_IMPROVEMENT and there were at
+// least FOLLOW_THE_WORKLOAD_MIN_REQUESTS requests.
+double FOLLOW_THE_WORKLOAD_MIN_IMPROVEMENT = 0.25;
+int FOLLOW_THE_WORKLOAD_MIN_REQUESTS = 4;
 
 /*
  * The distribution layer is responsible for distributing data across the nodes in a cluster. It consists of a
@@ -41,10 +63,12 @@ int MAX_KEY = 100;
  *       3.  Having the appropriate RangeDescriptor, the node will check if it is the leaseholder for that Range. If so,
  *           it can start processing the command (move to step 4). Otherwise, it will forward it to the leaseholder
  *           (returning to step 2).
- *       4.  Once the node knows it is the leaseholder of the range responsible for handling the key, it will propose the
- *           command to the leader (because it's the only node in the Range's Raft group allowed to do so).
+ *       4.  Once the node knows it is the leaseholder of the range responsible for handling the key, it will serve READ
+ *           operations from its own store, as long as it has applied every write it proposed. Any other command is
+ *           proposed to the leader (because it's the only node in the Range's Raft group allowed to do so).
  *       5.  Once the command is proposed to the leader, it will start processing the command as follows:
- *           - If it's a READ operation, it will just return the local result it gets from applying the operation.
+ *           - If it's a READ operation (which only reaches the leader if the leaseholder is behind), it will just
+ *             return the local result it gets from applying the operation.
  *           - Else:
  *              - It will push the command to its own log, and make sure all other replicas do the same.
  *              - Once all replicas have pushed the command to their logs, the leader can commit the operation. Thus, the
@@ -57,60 +81,780 @@ int MAX_KEY = 100;
  * Limitations
  * We made some assumptions that simplified the simulated process in comparison to the real implementation. Some
  * of them are:
- * - We don't implement expiration in Leases nor a Lease acquire mechanism, for which Raft is used.
+ * - Leases are epoch-based: they are kept alive by the liveness heartbeats of the leaseholder (one per node and tick,
+ *   regardless of how many leases it holds), and are acquired by another replica once the leaseholder's liveness record
+ *   expires. Leases are transferred cooperatively, with the outgoing leaseholder handing over the highest timestamp at
+ *   which it served reads. However, acquiring a lease doesn't go through Raft, and Raft elections are simulated by
+ *   picking a live replica.
  * - We don't have a distributed range descriptor table. Instead, we just pass a copy of the complete table to each node,
  *   using a std::map which is a balanced-search tree. This helps make fast lookups of ranges (O (log n).
- * - The leaseholder and leader of a Range are determined manually here. In practice, this is done using the Raft
- *   algorithm, taking into account as well the distribution policies explained during the presentation.
- * - We use a fixed number of Ranges with a fixed size of keys. In the real implementation ranges grow and split, or
- *   shrink and merge dynamically.
- * - We obviously don't use network communication between nodes, which are represented by objects.
- * - We use a std::map to represent RocksDB.
+ * - The leaseholder and leader of a Range are initially determined manually here. In practice, this is done using the
+ *   Raft algorithm, taking into account as well the distribution policies explained during the presentation. Leases
+ *   are later moved away from overloaded nodes by a simple lease rebalancer.
+ * - We start with a fixed number of Ranges with a fixed size of keys, which are split when they receive too many
+ *   requests and merged when adjacent Ranges are small and cold. In the real implementation ranges also grow and split
+ *   by size.
+ * - We obviously don't use network communication between nodes, which are represented by objects. Instead, a
+ *   simulated network keeps track of the hops and latency that requests would have accumulated.
+ * - We use a std::map of versions per key to represent RocksDB, and garbage collection removes old versions in place
+ *   instead of compacting them away.
  * - We don't have a real Log, we use a queue to represent it.
  * - When simulating replication in the Raft algorithm, we check sequentially that each node completes the operation.
- *   Apart from this, instead of waiting for a majority of nodes to signal completion, we wait for all of them.
- * - Usually the system tries to assign the leaseholder and leader to be the same node, but for demonstration purposes
- *   we always have the leaseholder be a different node than the leader.
+ *   Apart from this, we wait for all of the live replicas to apply the command (and fail if they are not a majority),
+ *   although the latency is that of the slowest replica needed to form a majority.
+ * - Nodes are placed in simulated regions and zones, and the allocator spreads the replicas of each Range across them.
+ *   The latency between nodes only depends on whether they are in the same region.
+ * - Zone configs set the number of replicas, constraints and lease preferences of spans of keys, but constraints apply
+ *   to every replica of a Range (there are no per-replica constraints).
+ * - Followers serve reads and scans at timestamps that the leaseholder has closed, and every replica keeps the
+ *   versions of its keys for the GC TTL of their zone config, so they can be read as of any timestamp since then.
+ *   Scans of the latest values are not a consistent snapshot across Ranges, since each Range is read at the time its
+ *   leaseholder serves it.
+ * - Every node has a hybrid logical clock, but all of them read their physical time from the same simulated clock, so
+ *   there is no clock skew to account for.
+ * - Leaseholders acquire latches over the keys of every command so that only overlapping commands are serialized, but
+ *   nodes still process commands one at a time; only the latch manager itself is exercised by several threads.
+ * - Commands that find an intent of another transaction wait for its lock in the lock table of the leaseholder and push
+ *   the transaction, but since nodes process commands one at a time, they give up instead of waiting if the push
+ *   fails; only the lock table itself is exercised by several threads. Transactions whose writes were pushed above the
+ *   timestamp at which they read (or that were pushed by a reader) must be retried, since their reads are not
+ *   refreshed. Coordinators don't heartbeat their transactions, so transactions are only aborted by pushers or
+ *   recovered once the liveness record of their coordinator expires.
+ * - Usually the system tries to assign the leaseholder and leader to be the same node, which is also what we do by
+ *   default (leadership follows the lease), but for demonstration purposes the main function disables this so that the
+ *   leaseholder is always a different node than the leader.
  */
 class DistributionLayer {
     map<int, Node*> nodes_map_;
     int total_nodes_;
+    // Zone config of each span of keys, by the first key of the span. Each span ends right before the next one starts,
+    // and Ranges never cross from one span to another.
+    map<int, ZoneConfig> span_start_to_zone_config_;
+    int next_node_id_ = 0;
+    // Nodes that are being drained before being removed from the cluster. They don't serve leases nor receive
+    // replicas, and are removed once they no longer hold any replica.
+    set<int> decommissioning_nodes_;
+    // Node through which the clients reach the cluster, or -1 if they pick a random node for each request.
+    int gateway_id_ = -1;
+    // Authoritative copy of the range descriptor table. Every change to it is gossiped to all nodes.
+    map<int, RangeDescriptor> interval_start_to_range_descriptor_;
+    int next_range_id_ = 0;
+    int operations_since_tick_ = 0;
+    ClusterSettings settings_;
+    SimulatedNetwork network_;
+    SimulatedClock clock_;
+    NodeLiveness liveness_{&clock_};
+    // Requests served so far, and the simulated time it took to serve them given that every node can only serve
+    // NODE_CAPACITY requests per unit of time.
+    long long requests_served_ = 0;
+    double busy_time_ = 0;
 
+    // Clients only contact nodes that are up and not being decommissioned. Returns -1 if there is none.
     [[nodiscard]] int get_random_node_id() const {
-        return rand() % total_nodes_;
+        vector<int> node_ids;
+        for (const auto &[node_id, node] : nodes_map_) {
+            if (node->IsLive() && !decommissioning_nodes_.contains(node_id)) node_ids.push_back(node_id);
+        }
+        if (node_ids.empty()) {
+            cout << "No node can serve as a gateway" << endl;
+            return -1;
+        }
+        return node_ids[rand() % node_ids.size()];
+    }
+
+    [[nodiscard]] int get_gateway_node_id() const {
+        if (gateway_id_ >= 0 && nodes_map_.contains(gateway_id_) && nodes_map_.at(gateway_id_)->IsLive()) {
+            return gateway_id_;
+        }
+        return get_random_node_id();
+    }
+
+    // Sends the command through the node coordinating the transaction, or through the gateway if there is none.
+    int SendCommand(const Command &command, long long transaction_id) {
+        if (transaction_id == 0) {
+            int gateway_id = get_gateway_node_id();
+            return gateway_id < 0 ? -1 : nodes_map_[gateway_id]->SendCommand(command);
+        }
+        int coordinator_id = CoordinatorId(transaction_id);
+        if (!nodes_map_.contains(coordinator_id)) {
+            cout << "The coordinator of transaction " << transaction_id << " is no longer in the cluster" << endl;
+            return -1;
+        }
+        return nodes_map_[coordinator_id]->SendTransactionalCommand(transaction_id, command);
+    }
+
+    // Sends a read-modify-write command, which the leaseholder of the key evaluates against its current value and
+    // replicates as the write it results in, so the client needs a single request instead of a read and then a write
+    // (which another writer could get in between of). They can't be part of a transaction.
+    int ReadModifyWrite(const Command &command, const string &operation) {
+        if (command.key < 0 || command.key > MAX_KEY) {
+            cout << "Key must be between 0 and MAX_KEY" << endl;
+            cout << operation << " FAILED" << endl << endl << endl;
+            return -1;
+        }
+
+        auto output = SendCommand(command, 0);
+        if (output < 0) cout << operation << " FAILED" << endl << endl << endl;
+        else cout << operation << " SUCCESSFUL (VALUE = " << output << ")" << endl << endl << endl;
+        RecordOperation();
+        return output;
+    }
+
+    int EndTransaction(long long transaction_id, bool commit) {
+        string operation = commit ? "COMMIT" : "ABORT";
+        cout << "STARTING " << operation << " OF TRANSACTION " << transaction_id << endl;
+        int coordinator_id = CoordinatorId(transaction_id);
+        int output = -1;
+        if (nodes_map_.contains(coordinator_id)) {
+            output = nodes_map_[coordinator_id]->EndTransaction(transaction_id, commit);
+        }
+        if (output < 0) cout << operation << " FAILED" << endl << endl << endl;
+        else cout << operation << " SUCCESSFUL" << endl << endl << endl;
+        RecordOperation();
+        return output;
+    }
+
+    // Hands every node a copy of the pointers to all nodes in the cluster, after nodes join or leave.
+    void AssignNodes() {
+        for (const auto &[_, node] : nodes_map_) {
+            node->AssignNodes(nodes_map_);
+        }
+    }
+
+    void GossipRangeDescriptors() {
+        for (const auto &[_, node] : nodes_map_) {
+            node->UpdateRangeDescriptors(interval_start_to_range_descriptor_);
+        }
+    }
+
+    // Leases can only be moved to live nodes that are not being decommissioned.
+    [[nodiscard]] bool CanReceiveLease(int node_id) const {
+        return liveness_.IsLive(node_id) && !decommissioning_nodes_.contains(node_id);
+    }
+
+    [[nodiscard]] const ZoneConfig &GetZoneConfig(const RangeDescriptor &descriptor) const {
+        return prev(span_start_to_zone_config_.upper_bound(descriptor.start))->second;
+    }
+
+    // Nodes on which the lease of a Range should be according to its zone config: those matching its first lease
+    // preference, then those matching the second one, and so on. Ranges with constraints but no lease preferences can
+    // have their lease on any node satisfying the constraints, and Ranges with neither keep their own preferences.
+    [[nodiscard]] vector<int> ResolveLeasePreferences(const RangeDescriptor &descriptor) const {
+        const auto &config = GetZoneConfig(descriptor);
+        auto constraints = VoterConstraints(config);
+        vector<Constraint> preferences = config.lease_preferences;
+        if (preferences.empty() && constraints.empty()) return descriptor.lease_preferences;
+        if (preferences.empty()) preferences.push_back({});
+
+        vector<int> node_ids;
+        for (const auto &preference : preferences) {
+            for (const auto &[node_id, node] : nodes_map_) {
+                auto locality = node->GetLocality();
+                if (!SatisfiesConstraints(locality, constraints)) continue;
+                if (!preference.key.empty() && !Matches(locality, preference)) continue;
+                if (find(node_ids.begin(), node_ids.end(), node_id) == node_ids.end()) node_ids.push_back(node_id);
+            }
+        }
+        return node_ids;
+    }
+
+    // Brings the lease preferences of every Range up to date with its zone config, since nodes may have joined or left
+    // since they were last resolved.
+    void ApplyZoneConfigs() {
+        bool changed = false;
+        for (auto &[_, descriptor] : interval_start_to_range_descriptor_) {
+            auto preferences = ResolveLeasePreferences(descriptor);
+            if (preferences == descriptor.lease_preferences) continue;
+            descriptor.lease_preferences = preferences;
+            changed = true;
+        }
+        if (changed) GossipRangeDescriptors();
+    }
+
+    // Splits the Range containing key so that a new Range starts at it, unless one already does.
+    void SplitAt(int key) {
+        if (key <= 0 || key > MAX_KEY || interval_start_to_range_descriptor_.contains(key)) return;
+        SplitRange(prev(interval_start_to_range_descriptor_.upper_bound(key))->second, key);
+    }
+
+    // A Range without lease preferences can have its lease on any replica.
+    [[nodiscard]] static bool SatisfiesLeasePreferences(const RangeDescriptor &descriptor, int node_id) {
+        const auto &preferences = descriptor.lease_preferences;
+        return preferences.empty() || find(preferences.begin(), preferences.end(), node_id) != preferences.end();
+    }
+
+    void RecordOperation() {
+        if (++operations_since_tick_ >= OPERATIONS_PER_TICK) Tick();
+    }
+
+    // Number of Ranges for which each node is the leaseholder.
+    [[nodiscard]] map<int, int> CountLeases() const {
+        map<int, int> leases;
+        for (const auto &[_, descriptor] : interval_start_to_range_descriptor_) leases[descriptor.leaseholder_id]++;
+        return leases;
+    }
+
+    // Splits the Range at split_key, so that the left-hand side keeps [start, split_key - 1] and a new Range is created
+    // for [split_key, end]. Both sides keep the same replicas (so no data needs to be moved), but the lease of the
+    // right-hand side is given to the replica with the fewest leases that is neither the leader nor the current
+    // leaseholder, which spreads the load of a hot Range across different nodes.
+    void SplitRange(RangeDescriptor left, int split_key) {
+        RangeDescriptor right = left;
+        right.id = next_range_id_++;
+        right.start = split_key;
+        left.end = split_key - 1;
+
+        cout << "Splitting range " << left.id << " at key " << split_key << endl;
+        auto leases = CountLeases();
+        int target_id = left.leaseholder_id;
+        for (auto replica_id : right.replicas_id) {
+            if (replica_id == left.leader_id || replica_id == left.leaseholder_id) continue;
+            if (!CanReceiveLease(replica_id)) continue;
+            if (target_id == left.leaseholder_id || leases[replica_id] < leases[target_id]) target_id = replica_id;
+        }
+        if (target_id != right.leaseholder_id) TransferLease(right, target_id);
+        // Every replica has applied all writes to the right-hand side at or below the closed timestamp of the whole
+        // Range, so it can keep serving follower reads there until the right-hand side publishes its own.
+        auto replicas_id = left.replicas_id;
+        replicas_id.insert(left.non_voters_id.begin(), left.non_voters_id.end());
+        for (auto replica_id : replicas_id) {
+            auto replica = nodes_map_[replica_id];
+            replica->SetClosedTimestamp(right.id, replica->ClosedTimestamp(left.id));
+        }
+
+        interval_start_to_range_descriptor_[left.start] = left;
+        interval_start_to_range_descriptor_[right.start] = right;
+        print_range_descriptor(left);
+        print_range_descriptor(right);
+        cout << endl;
+    }
+
+    // Moves the GC threshold of every Range to gc_ttl ticks ago (see ZoneConfig), and has its replicas remove the
+    // versions of its keys that reads at or above the new threshold can no longer see.
+    void RunGCQueue() {
+        vector<RangeDescriptor> collected;
+        for (auto &[_, descriptor] : interval_start_to_range_descriptor_) {
+            long long ttl = GetZoneConfig(descriptor).gc_ttl;
+            if (clock_.Now() <= ttl) continue;
+            Timestamp threshold = TickTimestamp(clock_.Now() - ttl);
+            if (threshold <= descriptor.gc_threshold) continue;
+            descriptor.gc_threshold = threshold;
+            collected.push_back(descriptor);
+        }
+        if (collected.empty()) return;
+        GossipRangeDescriptors();
+
+        for (const auto &descriptor : collected) {
+            auto replicas_id = descriptor.replicas_id;
+            replicas_id.insert(descriptor.non_voters_id.begin(), descriptor.non_voters_id.end());
+            int removed = 0;
+            for (auto replica_id : replicas_id) removed += nodes_map_[replica_id]->GarbageCollect(descriptor);
+            if (removed > 0) {
+                cout << "GC removed " << removed << " versions from the replicas of range " << descriptor.id << endl;
+            }
+        }
+    }
+
+    // Splits every Range whose leaseholder received at least LOAD_SPLIT_THRESHOLD requests during the last tick, at the
+    // key that balances the sampled requests.
+    void RunSplitQueue() {
+        vector<pair<RangeDescriptor, int>> splits;
+        for (const auto &[_, descriptor] : interval_start_to_range_descriptor_) {
+            auto load = nodes_map_[descriptor.leaseholder_id]->GetRangeLoad(descriptor.id);
+            if (load.Requests() < LOAD_SPLIT_THRESHOLD) continue;
+
+            int split_key = load.FindSplitKey(descriptor.start, descriptor.end);
+            if (split_key < 0) continue;
+            cout << "Range " << descriptor.id << " is hot (" << load.Requests() << " requests in the last tick)" << endl;
+            splits.emplace_back(descriptor, split_key);
+        }
+
+        for (const auto &[descriptor, split_key] : splits) SplitRange(descriptor, split_key);
+        if (!splits.empty()) GossipRangeDescriptors();
+    }
+
+    [[nodiscard]] int RangeSize(const RangeDescriptor &descriptor) {
+        return nodes_map_[descriptor.leaseholder_id]->CountKeys(descriptor.start, descriptor.end);
+    }
+
+    // Moves the voting replicas of the Range to the nodes in target_replicas_id, and its non-voting replicas to those in
+    // target_non_voters_id. New replicas receive a snapshot of the data from the leaseholder, and nodes that stop being
+    // replicas have the data of the Range removed.
+    void RelocateReplicas(RangeDescriptor &descriptor, const set<int> &target_replicas_id,
+                          const set<int> &target_non_voters_id) {
+        auto is_replica = [](const set<int> &replicas_id, const set<int> &non_voters_id, int node_id) {
+            return replicas_id.contains(node_id) || non_voters_id.contains(node_id);
+        };
+        auto leaseholder = nodes_map_[descriptor.leaseholder_id];
+        auto snapshot = leaseholder->GetSnapshot(descriptor.start, descriptor.end);
+        for (const auto &[node_id, node] : nodes_map_) {
+            bool was_replica = is_replica(descriptor.replicas_id, descriptor.non_voters_id, node_id);
+            bool is_target = is_replica(target_replicas_id, target_non_voters_id, node_id);
+            if (!was_replica && is_target) {
+                node->ApplySnapshot(snapshot);
+                node->ForwardAppliedIndex(descriptor.id, leaseholder->GetAppliedIndex(descriptor.id));
+            }
+            if (was_replica && !is_target) node->ClearRange(descriptor.start, descriptor.end);
+        }
+        descriptor.replicas_id = target_replicas_id;
+        descriptor.non_voters_id = target_non_voters_id;
+    }
+
+    void RelocateReplicas(RangeDescriptor &descriptor, const set<int> &target_replicas_id) {
+        RelocateReplicas(descriptor, target_replicas_id, descriptor.non_voters_id);
+    }
+
+    // Merges the right-hand side Range into the left-hand side one. The replicas of both Ranges must be on the same
+    // nodes before merging, so the replicas of the right-hand side are moved to the nodes of the left-hand side first.
+    // The merged Range keeps the leader and leaseholder of the left-hand side, which can't write below the reads served
+    // by the leaseholder of the right-hand side.
+    void MergeRanges(RangeDescriptor left, RangeDescriptor right) {
+        cout << "Merging range " << right.id << " into range " << left.id << endl;
+        if (left.leaseholder_id != right.leaseholder_id) {
+            auto right_leaseholder = nodes_map_[right.leaseholder_id];
+            nodes_map_[left.leaseholder_id]->ForwardTimestampCache(right.start, right.end,
+                                                                   right_leaseholder->LastTimestamp());
+        }
+        if (right.replicas_id != left.replicas_id || right.non_voters_id != left.non_voters_id) {
+            cout << "Colocating replicas of range " << right.id << " with those of range " << left.id << endl;
+            RelocateReplicas(right, left.replicas_id, left.non_voters_id);
+        }
+
+        // The merged Range has only closed what both sides had closed. Replicas that just received the right-hand side
+        // have no closed timestamp for it, so they can't serve follower reads until the next publication. The
+        // leaseholder still can't write below what the right-hand side had closed, since followers served reads there.
+        auto right_closed_timestamp = nodes_map_[right.leaseholder_id]->ClosedTimestamp(right.id);
+        nodes_map_[left.leaseholder_id]->ForwardTimestampCache(right.start, right.end, right_closed_timestamp);
+        auto replicas_id = left.replicas_id;
+        replicas_id.insert(left.non_voters_id.begin(), left.non_voters_id.end());
+        for (auto replica_id : replicas_id) {
+            auto replica = nodes_map_[replica_id];
+            replica->SetClosedTimestamp(left.id, min(replica->ClosedTimestamp(left.id),
+                                                     replica->ClosedTimestamp(right.id)));
+        }
+
+        left.end = right.end;
+        left.gc_threshold = max(left.gc_threshold, right.gc_threshold);
+        interval_start_to_range_descriptor_.erase(right.start);
+        interval_start_to_range_descriptor_[left.start] = left;
+        print_range_descriptor(left);
+        cout << endl;
+    }
+
+    // Merges adjacent Ranges that are both small and cold, so that the number of Ranges stays proportional to the
+    // amount of data instead of growing forever with splits.
+    void RunMergeQueue() {
+        bool merged = false;
+        auto it = interval_start_to_range_descriptor_.begin();
+        while (it != interval_start_to_range_descriptor_.end() && next(it) != interval_start_to_range_descriptor_.end()) {
+            auto left = it->second;
+            auto right = next(it)->second;
+            int size = RangeSize(left) + RangeSize(right);
+            int load = nodes_map_[left.leaseholder_id]->GetRangeLoad(left.id).Requests() +
+                       nodes_map_[right.leaseholder_id]->GetRangeLoad(right.id).Requests();
+
+            // Ranges in different spans may have different zone configs.
+            bool zone_boundary = span_start_to_zone_config_.contains(right.start);
+            if (size > MERGE_SIZE_THRESHOLD || load >= MERGE_LOAD_THRESHOLD || zone_boundary) {
+                it++;
+                continue;
+            }
+
+            MergeRanges(left, right);
+            merged = true;
+            // The merged Range is not considered again until the next tick.
+            it = interval_start_to_range_descriptor_.upper_bound(left.start);
+        }
+
+        if (merged) GossipRangeDescriptors();
+    }
+
+    // Number of requests served by each node as leaseholder during the current tick.
+    [[nodiscard]] map<int, int> NodeLoad() const {
+        map<int, int> load;
+        for (const auto &[node_id, _] : nodes_map_) load[node_id] = 0;
+        for (const auto &[_, descriptor] : interval_start_to_range_descriptor_) {
+            load[descriptor.leaseholder_id] +=
+                    nodes_map_.at(descriptor.leaseholder_id)->GetRangeLoad(descriptor.id).Requests();
+        }
+        return load;
+    }
+
+    // Raft leadership is transferred by the simulation whenever the leader has to leave a node, always to a replica
+    // that is not the leaseholder.
+    void TransferLeadership(RangeDescriptor &descriptor, int target_id) {
+        cout << "Transferring leadership of range " << descriptor.id << " from node " << descriptor.leader_id
+             << " to node " << target_id << endl;
+        descriptor.leader_id = target_id;
+    }
+
+    // Moves the lease and the leadership of every Range away from the node, so that it stops serving requests.
+    void DrainNode(int node_id) {
+        for (auto &[_, descriptor] : interval_start_to_range_descriptor_) {
+            if (descriptor.leaseholder_id != node_id && descriptor.leader_id != node_id) continue;
+            for (auto replica_id : descriptor.replicas_id) {
+                if (replica_id == descriptor.leader_id || replica_id == descriptor.leaseholder_id) continue;
+                if (!CanReceiveLease(replica_id)) continue;
+                if (descriptor.leaseholder_id == node_id) TransferLease(descriptor, replica_id);
+                else TransferLeadership(descriptor, replica_id);
+                break;
+            }
+        }
+        GossipRangeDescriptors();
+    }
+
+    // Removes the decommissioning nodes that no longer hold any replica.
+    void RemoveDecommissionedNodes() {
+        auto stores = GetStoreDescriptors();
+        for (auto it = decommissioning_nodes_.begin(); it != decommissioning_nodes_.end();) {
+            if (stores[*it].range_count > 0) {
+                it++;
+                continue;
+            }
+            cout << "Node " << *it << " has been decommissioned and removed from the cluster" << endl;
+            delete nodes_map_[*it];
+            nodes_map_.erase(*it);
+            total_nodes_--;
+            it = decommissioning_nodes_.erase(it);
+            AssignNodes();
+        }
+    }
+
+    // Moves the lease of the Range to target_id. With cooperative transfers, the outgoing leaseholder stops serving
+    // and proposes the new lease through Raft together with its current timestamp, above every read it served, which
+    // the incoming leaseholder adds to its timestamp cache for the whole Range. This way it can serve right away
+    // without ever applying a write below a read served by the outgoing one. Otherwise, the incoming leaseholder knows
+    // nothing about those reads, so it must wait until the outgoing leaseholder's liveness record would have expired
+    // (in which case it can't be serving anymore), and uses the start of its lease instead.
+    void TransferLease(RangeDescriptor &descriptor, int target_id) {
+        cout << "Transferring lease of range " << descriptor.id << " from node " << descriptor.leaseholder_id
+             << " to node " << target_id << endl;
+        auto source = nodes_map_[descriptor.leaseholder_id];
+        auto target = nodes_map_[target_id];
+        if (settings_.cooperative_lease_transfers && source->IsLive()) {
+            network_.RecordReplication(descriptor.leader_id, descriptor.replicas_id);
+            descriptor.lease_start = clock_.Now();
+            target->ForwardTimestampCache(descriptor.start, descriptor.end, source->LastTimestamp());
+            target->ForwardLeaseAppliedIndex(descriptor.id, source->GetLeaseAppliedIndex(descriptor.id));
+        } else {
+            descriptor.lease_start = clock_.Now() + LIVENESS_TTL;
+            target->ForwardTimestampCache(descriptor.start, descriptor.end, TickTimestamp(descriptor.lease_start));
+        }
+        descriptor.leaseholder_id = target_id;
+        descriptor.lease_epoch = liveness_.Epoch(target_id);
+        if (settings_.colocate_leaseholder_and_leader && descriptor.leader_id != target_id) {
+            TransferLeadership(descriptor, target_id);
+        }
+    }
+
+    // Recovers the Ranges whose leader or leaseholder is no longer live. Raft elects a new leader among the live
+    // replicas, and one of them acquires the lease after incrementing the epoch of the previous leaseholder, which
+    // invalidates all of its leases at once. A Range whose live replicas are not a majority stays unavailable.
+    void AcquireInvalidLeases() {
+        bool changed = false;
+        for (auto &[_, descriptor] : interval_start_to_range_descriptor_) {
+            bool leader_live = liveness_.IsLive(descriptor.leader_id);
+            bool lease_valid = liveness_.IsLeaseValid(descriptor.leaseholder_id, descriptor.lease_epoch);
+            if (leader_live && lease_valid) continue;
+
+            // Replicas on nodes being decommissioned still count towards a majority, but they can't take the lease (nor
+            // the leadership, unless no other replica can).
+            vector<int> live_replicas_id;
+            vector<int> lease_candidates_id;
+            for (auto replica_id : descriptor.replicas_id) {
+                if (!liveness_.IsLive(replica_id)) continue;
+                live_replicas_id.push_back(replica_id);
+                if (CanReceiveLease(replica_id)) lease_candidates_id.push_back(replica_id);
+            }
+            if (live_replicas_id.size() <= descriptor.replicas_id.size() / 2) {
+                cout << "Range " << descriptor.id << " lost a majority of its replicas and is unavailable" << endl;
+                continue;
+            }
+            const auto &leader_candidates_id = lease_candidates_id.empty() ? live_replicas_id : lease_candidates_id;
+
+            if (!leader_live) {
+                int leader_id = leader_candidates_id[0];
+                if (lease_valid && !settings_.colocate_leaseholder_and_leader) {
+                    for (auto replica_id : leader_candidates_id) {
+                        if (replica_id != descriptor.leaseholder_id) leader_id = replica_id;
+                    }
+                } else if (lease_valid) {
+                    leader_id = descriptor.leaseholder_id;
+                }
+                cout << "Node " << leader_id << " was elected leader of range " << descriptor.id << endl;
+                descriptor.leader_id = leader_id;
+            }
+
+            if (!lease_valid && lease_candidates_id.empty()) {
+                cout << "No replica of range " << descriptor.id << " can acquire its lease" << endl;
+            } else if (!lease_valid) {
+                int target_id = CanReceiveLease(descriptor.leader_id) ? descriptor.leader_id : lease_candidates_id[0];
+                if (!settings_.colocate_leaseholder_and_leader) {
+                    for (auto replica_id : lease_candidates_id) {
+                        if (replica_id != descriptor.leader_id) target_id = replica_id;
+                    }
+                }
+                if (liveness_.Epoch(descriptor.leaseholder_id) == descriptor.lease_epoch) {
+                    liveness_.IncrementEpoch(descriptor.leaseholder_id);
+                }
+                cout << "Node " << target_id << " acquired the lease of range " << descriptor.id
+                     << " previously held by node " << descriptor.leaseholder_id << endl;
+                descriptor.leaseholder_id = target_id;
+                descriptor.lease_epoch = liveness_.Epoch(target_id);
+                // The previous leaseholder can't serve anymore since its epoch was incremented, so the new lease starts
+                // right away. Reads it served are unknown, so the new leaseholder won't write below this moment.
+                descriptor.lease_start = clock_.Now();
+                auto now = TickTimestamp(clock_.Now());
+                nodes_map_[target_id]->ForwardTimestampCache(descriptor.start, descriptor.end, now);
+            }
+            changed = true;
+        }
+        if (changed) GossipRangeDescriptors();
+    }
+
+    // Moves the leadership of every Range to its leaseholder, e.g. after colocation has been enabled.
+    void ColocateLeadersWithLeaseholders() {
+        bool transferred = false;
+        for (auto &[_, descriptor] : interval_start_to_range_descriptor_) {
+            if (descriptor.leader_id == descriptor.leaseholder_id) continue;
+            TransferLeadership(descriptor, descriptor.leaseholder_id);
+            transferred = true;
+        }
+        if (transferred) GossipRangeDescriptors();
+    }
+
+    // Moves leases away from the nodes that serve considerably more requests than the mean, starting with their
+    // busiest Ranges. A lease is only moved to another replica (that is not the leader) if that does not leave the
+    // target node busier than the source one.
+    void RunLeaseRebalancer() {
+        auto load = NodeLoad();
+        int total_load = 0;
+        for (const auto &[_, node_load] : load) total_load += node_load;
+        if (total_load == 0) return;
+        double upper_bound =
+                (1 + LEASE_REBALANCE_THRESHOLD) * total_load / (total_nodes_ - (int) decommissioning_nodes_.size());
+
+        bool transferred = false;
+        for (const auto &[node_id, _] : nodes_map_) {
+            if (load[node_id] <= upper_bound) continue;
+
+            vector<pair<int, int>> leased_ranges; // (load, start) of the Ranges leased by this node
+            for (const auto &[start, descriptor] : interval_start_to_range_descriptor_) {
+                if (descriptor.leaseholder_id != node_id) continue;
+                leased_ranges.emplace_back(nodes_map_[node_id]->GetRangeLoad(descriptor.id).Requests(), start);
+            }
+            sort(leased_ranges.rbegin(), leased_ranges.rend());
+
+            for (auto [range_load, start] : leased_ranges) {
+                if (load[node_id] <= upper_bound) break;
+                auto &descriptor = interval_start_to_range_descriptor_[start];
+                int target_id = -1;
+                for (auto replica_id : descriptor.replicas_id) {
+                    if (replica_id == node_id || replica_id == descriptor.leader_id) continue;
+                    if (!CanReceiveLease(replica_id) || !SatisfiesLeasePreferences(descriptor, replica_id)) continue;
+                    if (target_id < 0 || load[replica_id] < load[target_id]) target_id = replica_id;
+                }
+                if (target_id < 0 || load[target_id] + range_load >= load[node_id]) continue;
+
+                TransferLease(descriptor, target_id);
+                load[node_id] -= range_load;
+                load[target_id] += range_load;
+                transferred = true;
+            }
+        }
+
+        if (transferred) GossipRangeDescriptors();
+    }
+
+    // Moves leases that are not where they should be: first to the most preferred live replica of Ranges with lease
+    // preferences, and then, with follow-the-workload, to the replica closest to the nodes through which the requests of
+    // the Range arrive (usually in the same region), which saves those requests the trip to a distant leaseholder.
+    // Follow-the-workload never moves a lease against the lease preferences, nor to a node that would become overloaded.
+    void RunLeasePlacement() {
+        auto load = NodeLoad();
+        int total_load = 0;
+        for (const auto &[_, node_load] : load) total_load += node_load;
+        double upper_bound =
+                (1 + LEASE_REBALANCE_THRESHOLD) * total_load / (total_nodes_ - (int) decommissioning_nodes_.size());
+
+        bool transferred = false;
+        for (auto &[_, descriptor] : interval_start_to_range_descriptor_) {
+            auto can_hold_lease = [&](int node_id) {
+                if (!descriptor.replicas_id.contains(node_id) || !CanReceiveLease(node_id)) return false;
+                return settings_.colocate_leaseholder_and_leader || node_id != descriptor.leader_id;
+            };
+
+            int target_id = -1;
+            for (auto node_id : descriptor.lease_preferences) {
+                if (can_hold_lease(node_id)) {
+                    target_id = node_id;
+                    break;
+                }
+            }
+            // The lease is already on one of the preferred nodes, even if not the first one, e.g. because of load.
+            if (SatisfiesLeasePreferences(descriptor, descriptor.leaseholder_id)) target_id = -1;
+
+            auto range_load = nodes_map_[descriptor.leaseholder_id]->GetRangeLoad(descriptor.id);
+            if (target_id < 0 && settings_.follow_the_workload) {
+                // Latency that the recent requests of the Range would have accumulated reaching each replica.
+                auto cost = [&](int node_id) {
+                    double latency = 0;
+                    for (const auto &[origin_id, requests] : range_load.RequestsByOrigin()) {
+                        latency += requests * network_.Latency(origin_id, node_id);
+                    }
+                    return latency;
+                };
+                double requests = 0;
+                for (const auto &[_, origin_requests] : range_load.RequestsByOrigin()) requests += origin_requests;
+
+                int closest_id = -1;
+                for (auto replica_id : descriptor.replicas_id) {
+                    if (!can_hold_lease(replica_id) || !SatisfiesLeasePreferences(descriptor, replica_id)) continue;
+                    if (closest_id < 0 || cost(replica_id) < cost(closest_id)) closest_id = replica_id;
+                }
+                if (requests >= FOLLOW_THE_WORKLOAD_MIN_REQUESTS && closest_id >= 0
+                    && cost(closest_id) < (1 - FOLLOW_THE_WORKLOAD_MIN_IMPROVEMENT) * cost(descriptor.leaseholder_id)
+                    && (total_load == 0 || load[closest_id] + range_load.Requests() <= upper_bound)) {
+                    cout << "Node " << closest_id << " is closer to the requests for range " << descriptor.id << endl;
+                    target_id = closest_id;
+                }
+            }
+
+            if (target_id < 0 || target_id == descriptor.leaseholder_id) continue;
+            load[descriptor.leaseholder_id] -= range_load.Requests();
+            load[target_id] += range_load.Requests();
+            TransferLease(descriptor, target_id);
+            transferred = true;
+        }
+
+        if (transferred) GossipRangeDescriptors();
+    }
+
+    [[nodiscard]] map<int, StoreDescriptor> GetStoreDescriptors() const {
+        map<int, StoreDescriptor> stores;
+        for (const auto &[node_id, node] : nodes_map_) {
+            stores[node_id].node_id = node_id;
+            stores[node_id].disk_usage = node->DiskUsage();
+            stores[node_id].locality = node->GetLocality();
+            stores[node_id].decommissioning = decommissioning_nodes_.contains(node_id);
+            stores[node_id].live = liveness_.IsLive(node_id);
+        }
+        for (const auto &[node_id, load] : NodeLoad()) stores[node_id].load = load;
+        for (const auto &[_, descriptor] : interval_start_to_range_descriptor_) {
+            for (auto replica_id : descriptor.replicas_id) stores[replica_id].range_count++;
+            for (auto replica_id : descriptor.non_voters_id) stores[replica_id].range_count++;
+        }
+        return stores;
+    }
+
+    // Makes sure that every Range has as many voting and non-voting replicas as its zone config asks for, on nodes
+    // satisfying its constraints, and moves at most one voting replica of each Range from the fullest to the least full
+    // nodes according to the allocator. Non-voting replicas are only moved off nodes that can't keep them, or to make
+    // the Range more diverse.
+    void RunReplicateQueue() {
+        Allocator allocator{GetStoreDescriptors(), settings_.locality_aware_allocation};
+        bool changed = false;
+        for (auto &[_, descriptor] : interval_start_to_range_descriptor_) {
+            RangeUsage usage{RangeSize(descriptor)};
+            const auto &config = GetZoneConfig(descriptor);
+            auto voter_constraints = VoterConstraints(config);
+            int num_voters = NumVoters(config);
+            int num_non_voters = config.num_replicas - num_voters;
+            auto target_replicas_id = descriptor.replicas_id;
+            auto target_non_voters_id = descriptor.non_voters_id;
+            int remove_id = -1, add_id = -1;
+            int remove_non_voter_id = -1, add_non_voter_id = -1;
+
+            if ((int) descriptor.replicas_id.size() < num_voters) {
+                add_id = allocator.AllocateTarget(descriptor.replicas_id, voter_constraints, descriptor.non_voters_id);
+            } else if ((int) descriptor.replicas_id.size() > num_voters) {
+                remove_id = allocator.RemoveTarget(descriptor, voter_constraints);
+            } else {
+                tie(remove_id, add_id) = allocator.RebalanceTarget(descriptor, usage, voter_constraints);
+            }
+
+            auto all_replicas_id = descriptor.replicas_id;
+            all_replicas_id.insert(descriptor.non_voters_id.begin(), descriptor.non_voters_id.end());
+            if (add_id >= 0) all_replicas_id.insert(add_id);
+            if ((int) descriptor.non_voters_id.size() < num_non_voters) {
+                add_non_voter_id = allocator.AllocateTarget(all_replicas_id, config.constraints);
+            } else if ((int) descriptor.non_voters_id.size() > num_non_voters) {
+                remove_non_voter_id = allocator.RemoveNonVoterTarget(descriptor, config.constraints);
+            } else {
+                tie(remove_non_voter_id, add_non_voter_id) =
+                        allocator.RebalanceNonVoterTarget(descriptor, config.constraints);
+                if (add_non_voter_id == add_id) remove_non_voter_id = add_non_voter_id = -1;
+            }
+            if (remove_id < 0 && add_id < 0 && remove_non_voter_id < 0 && add_non_voter_id < 0) continue;
+
+            if (remove_id >= 0) {
+                cout << "Removing replica of range " << descriptor.id << " from node " << remove_id << endl;
+                target_replicas_id.erase(remove_id);
+            }
+            if (add_id >= 0) {
+                cout << "Adding replica of range " << descriptor.id << " to node " << add_id << endl;
+                target_replicas_id.insert(add_id);
+            }
+            if (remove_non_voter_id >= 0) {
+                cout << "Removing non-voting replica of range " << descriptor.id << " from node "
+                     << remove_non_voter_id << endl;
+                target_non_voters_id.erase(remove_non_voter_id);
+            }
+            if (add_non_voter_id >= 0) {
+                cout << "Adding non-voting replica of range " << descriptor.id << " to node " << add_non_voter_id
+                     << endl;
+                target_non_voters_id.insert(add_non_voter_id);
+            }
+            RelocateReplicas(descriptor, target_replicas_id, target_non_voters_id);
+            allocator.RecordMove(remove_id, add_id, usage);
+            allocator.RecordMove(remove_non_voter_id, add_non_voter_id, usage);
+            changed = true;
+        }
+
+        if (changed) GossipRangeDescriptors();
     }
 public:
     // The number of nodes and replication factor must be >= 3.
     // Replication factor must be <= the number of nodes.
-    DistributionLayer(int number_of_nodes, int replication_factor) : total_nodes_{number_of_nodes} {
+    DistributionLayer(int number_of_nodes, int replication_factor, const ClusterSettings &settings = {})
+            : DistributionLayer(DefaultLocalities(number_of_nodes), replication_factor, settings) {
+    }
+
+    // Creates one node for each of the given localities.
+    DistributionLayer(const vector<Locality> &localities, int replication_factor, const ClusterSettings &settings = {})
+            : total_nodes_{(int) localities.size()}, settings_{settings} {
+        int number_of_nodes = (int) localities.size();
         if (number_of_nodes < 3 || replication_factor < 3 || replication_factor > number_of_nodes)
             throw exception{};
 
         // Providing a seed value
         srand((unsigned) time(nullptr));
 
+        // The whole key space starts with the same zone config, which can later be changed for any span of keys.
+        span_start_to_zone_config_[0].num_replicas = replication_factor;
+
         // Since the distribution layer is in charge of knowing which node is the leaseholder for a particular Range, we
         // will maintain a sorted map (underlying balanced search tree) with the start value of the range as the key, and
         // the corresponding RangeDescriptor as value. This is so that we can find in O(log N) the Range to which the
         // searched key belongs. In order to do this, we can search for the largest value that is less than the key.
         // We will hand a copy of this map to every node, so that each one can find the appropriate Leaseholder.
         // In practice, this info is stored on System Ranges replicated in each node.
-        map<int, RangeDescriptor> interval_start_to_range_descriptor;
 
         // First of all, we initialize Ranges
         // Originally, Ranges either:
         // - Grow and split, or
         // - Shrink and merge
         // This is done dynamically as the data inside each is added or deleted.
-        // However, to simplify the simulation, here we only have a fixed number of Ranges = 2n, where n is the number
-        // of nodes. We consider the keyspace to be the closed interval [0, MAX_KEY].
+        // However, to simplify the simulation, here we start with a fixed number of Ranges = 2n, where n is the number
+        // of nodes, and only split them when they receive too many requests (see RunSplitQueue) or merge them when
+        // they are small and cold (see RunMergeQueue). We consider the keyspace to be the closed interval [0, MAX_KEY].
         // We divide the keyspace in n * 2 parts, so that we can have the same number of Ranges.
         int total_ranges = number_of_nodes * 2;
         int range_size = MAX_KEY / total_ranges;
 
         for (int i = 0; i < total_ranges; i++) {
             RangeDescriptor new_range;
-            new_range.id = i;
+            new_range.id = next_range_id_++;
             new_range.start = i * range_size;
 
             // If this is the last part, it may not have the same size as the other parts
@@ -122,37 +866,44 @@ public:
             // The leaseholder and leader of a Range are determined manually here. In practice, this is done using the
             // Raft algorithm, taking into account as well the distribution policies explained during the presentation.
 
-            // The leaseholder and the leader of a Range are often the same node, but they can be different. Here we let
-            // them be different nodes to differentiate between their functions. We assign a random leader for each
-            // Range. If the leader has id x, the leaseholder will be node x + 1, and remaining replicas will be
-            // assigned to subsequent nodes (x + 2, x + 3...). We use % number_of_nodes to restart the assignment to
-            // contiguous IDs.
+            // The leaseholder and the leader of a Range are often the same node, but they can be different. Unless
+            // they are colocated (the default), we let them be different nodes to differentiate between their
+            // functions. We assign a random leader for each Range. If the leader has id x, the leaseholder will be node
+            // x + 1 (we use % number_of_nodes to restart the assignment to contiguous IDs), and remaining replicas will
+            // be placed by the allocator on the nodes with the fewest replicas so far.
 
             new_range.leader_id = rand() % number_of_nodes;
             new_range.leaseholder_id = (new_range.leader_id + 1) % number_of_nodes;
+            if (settings.colocate_leaseholder_and_leader) new_range.leaseholder_id = new_range.leader_id;
 
             new_range.replicas_id.insert(new_range.leader_id);
             new_range.replicas_id.insert( new_range.leaseholder_id);
 
             // Add remaining replicas
-            int next_id = (new_range.leaseholder_id + 1) % number_of_nodes;
-            for (int j = 0; j < replication_factor - 2; j++) {
-                new_range.replicas_id.insert(next_id);
-                next_id = (next_id + 1) % number_of_nodes;
+            map<int, StoreDescriptor> stores;
+            for (int j = 0; j < number_of_nodes; j++) {
+                stores[j].node_id = j;
+                stores[j].locality = localities[j];
+            }
+            for (const auto &[_, range] : interval_start_to_range_descriptor_) {
+                for (auto replica_id : range.replicas_id) stores[replica_id].range_count++;
+            }
+            Allocator allocator{stores, settings.locality_aware_allocation};
+            while ((int) new_range.replicas_id.size() < replication_factor) {
+                new_range.replicas_id.insert(allocator.AllocateTarget(new_range.replicas_id));
             }
 
-            interval_start_to_range_descriptor[new_range.start] = new_range;
+            interval_start_to_range_descriptor_[new_range.start] = new_range;
             print_range_descriptor(new_range);
             cout << endl;
         }
 
         for (int i = 0; i < number_of_nodes; i++) {
-            nodes_map_[i] = new Node{i, interval_start_to_range_descriptor};
+            nodes_map_[i] = new Node{i, interval_start_to_range_descriptor_, &network_, &liveness_, &clock_, localities[i]};
         }
+        next_node_id_ = number_of_nodes;
         // Once all nodes have been created, hand a copy of pointers to all of them
-        for (const auto &[_, node] : nodes_map_) {
-            node->AssignNodes(nodes_map_);
-        }
+        AssignNodes();
     }
 
     ~DistributionLayer() {
@@ -164,9 +915,10 @@ public:
 
     // The distribution layer is in charge of knowing which node is the leaseholder for a particular Range using a
     // consistent hashing scheme. However, here we act as a client and pick a random node to make the query. The queried
-    // node then will have to find the appropriate Leaseholder.
+    // node then will have to find the appropriate Leaseholder. Every operation can also be run as part of a transaction
+    // (see BeginTransaction), in which case it goes through the node coordinating the transaction instead.
 
-    int Insert(int key, int value) {
+    int Insert(int key, int value, long long transaction_id = 0) {
         cout << "STARTING INSERTION OF PAIR (" + to_string(key) + ", " + to_string(value) + ")"<< endl;
         if (key < 0 || value < 0) {
             cout << "Key and value must be both nonnegative" << endl;
@@ -180,15 +932,31 @@ public:
             return -1;
         }
 
-        auto chosen_node = get_random_node_id();
-        auto output = nodes_map_[chosen_node]->SendCommand({CREATE, key, value});
+        auto output = SendCommand({CREATE, key, value}, transaction_id);
         if (output < 0) cout << "INSERTION FAILED" << endl << endl << endl;
         else cout << "INSERTION SUCCESSFUL" << endl << endl << endl;
+        RecordOperation();
         return output;
     }
 
-    int Get(int key) {
-        cout << "STARTING GET OF KEY " + to_string(key) << endl;
+    // Reads the latest value of the key, or the value as of the given timestamp. Reads at or below
+    // FollowerReadTimestamp() can be served by the closest replica instead of the leaseholder. Reads that are part of a
+    // transaction always read at the timestamp of the transaction.
+    int Get(int key, Timestamp timestamp = 0, long long transaction_id = 0) {
+        cout << "STARTING GET OF KEY " + to_string(key);
+        if (timestamp > 0) cout << " AS OF TIMESTAMP " << ToString(timestamp);
+        cout << endl;
+        if ((double) WallTime(timestamp) > (double) clock_.Now() * TICK_DURATION_MS) {
+            cout << "Cannot read at a timestamp in the future" << endl;
+            cout << "GET FAILED" << endl << endl << endl;
+            return -1;
+        }
+        if (timestamp > 0 && transaction_id != 0) {
+            cout << "Cannot read at a given timestamp inside a transaction" << endl;
+            cout << "GET FAILED" << endl << endl << endl;
+            return -1;
+        }
+
         if (key < 0) {
             cout << "Key and value must be both nonnegative" << endl;
             cout << "GET FAILED" << endl << endl << endl;
@@ -201,14 +969,60 @@ public:
             return -1;
         }
 
-        auto chosen_node = get_random_node_id();
-        auto output = nodes_map_[chosen_node]->SendCommand({READ, key});
+        auto output = SendCommand({READ, key, 0, timestamp}, transaction_id);
         if (output < 0) cout << "GET FAILED" << endl << endl << endl;
         else cout << "GET SUCCESSFUL (VALUE = " + to_string(output) + ")" << endl << endl << endl;
+        RecordOperation();
         return output;
     }
 
-    int Update(int key, int new_value) {
+    // Reads every key in [start, end] that exists, or that existed as of the given timestamp, into rows, and returns
+    // how many there are. The scan is split into one request per Range, all of them sent at the same time. Scans at or
+    // below FollowerReadTimestamp() can be served by the closest replica of each Range, and every Range is read at the
+    // same timestamp, so they see a consistent snapshot of the whole span (as long as it's above the GC threshold of
+    // its Ranges). Scans of the latest values read each Range at the time its leaseholder serves it instead.
+    int Scan(int start, int end, Timestamp timestamp = 0, map<int, int> *rows = nullptr) {
+        cout << "STARTING SCAN OF KEYS [" << start << ", " << end << "]";
+        if (timestamp > 0) cout << " AS OF TIMESTAMP " << ToString(timestamp);
+        cout << endl;
+        if ((double) WallTime(timestamp) > (double) clock_.Now() * TICK_DURATION_MS) {
+            cout << "Cannot read at a timestamp in the future" << endl;
+            cout << "SCAN FAILED" << endl << endl << endl;
+            return -1;
+        }
+
+        if (start < 0 || end > MAX_KEY || start > end) {
+            cout << "Keys must be between 0 and MAX_KEY, and start can't be greater than end" << endl;
+            cout << "SCAN FAILED" << endl << endl << endl;
+            return -1;
+        }
+
+        int gateway_id = get_gateway_node_id();
+        if (gateway_id < 0) {
+            cout << "SCAN FAILED" << endl << endl << endl;
+            return -1;
+        }
+        map<int, int> result;
+        bool failed = false;
+        auto gateway = nodes_map_[gateway_id];
+        network_.BeginParallel();
+        for (auto it = prev(interval_start_to_range_descriptor_.upper_bound(start));
+             it != interval_start_to_range_descriptor_.end() && it->first <= end; it++) {
+            network_.NextBranch();
+            Command scan{SCAN, max(start, it->second.start), min(end, it->second.end), timestamp};
+            if (gateway->SendCommand(scan, -1, nullptr, &result) < 0) failed = true;
+        }
+        network_.EndParallel();
+
+        int output = failed ? -1 : (int) result.size();
+        if (output < 0) cout << "SCAN FAILED" << endl << endl << endl;
+        else cout << "SCAN SUCCESSFUL (" << output << " KEYS)" << endl << endl << endl;
+        if (output >= 0 && rows != nullptr) *rows = result;
+        RecordOperation();
+        return output;
+    }
+
+    int Update(int key, int new_value, long long transaction_id = 0) {
         cout << "STARTING UPDATE USING PAIR (" + to_string(key) + ", " + to_string(new_value) + ")"<< endl;
         if (key < 0 || new_value < 0) {
             cout << "Key and value must be both nonnegative" << endl;
@@ -222,14 +1036,14 @@ public:
             return -1;
         }
 
-        auto chosen_node = get_random_node_id();
-        auto output = nodes_map_[chosen_node]->SendCommand({UPDATE, key, new_value});
+        auto output = SendCommand({UPDATE, key, new_value}, transaction_id);
         if (output < 0) cout << "UPDATE FAILED" << endl << endl << endl;
         else cout << "UPDATE SUCCESSFUL" << endl << endl << endl;
+        RecordOperation();
         return output;
     }
 
-    int Remove(int key) {
+    int Remove(int key, long long transaction_id = 0) {
         cout << "STARTING DELETION OF KEY " + to_string(key) << endl;
         if (key < 0) {
             cout << "Key and value must be both nonnegative" << endl;
@@ -243,21 +1057,1253 @@ public:
             return -1;
         }
 
-        auto chosen_node = get_random_node_id();
-        auto output = nodes_map_[chosen_node]->SendCommand({DELETE, key});
+        auto output = SendCommand({DELETE, key}, transaction_id);
         if (output < 0) cout << "DELETION FAILED" << endl << endl << endl;
         else cout << "DELETION SUCCESSFUL" << endl << endl << endl;
+        RecordOperation();
         return output;
     }
 
+    // Writes new_value to the key if its current value is expected_value. Returns 0 if it was written, and -1 otherwise.
+    int ConditionalPut(int key, int expected_value, int new_value) {
+        cout << "STARTING CONDITIONAL PUT OF PAIR (" << key << ", " << new_value << ") IF VALUE = " << expected_value
+             << endl;
+        if (new_value < 0) {
+            cout << "Key and value must be both nonnegative" << endl;
+            cout << "CONDITIONAL PUT FAILED" << endl << endl << endl;
+            return -1;
+        }
+        Command command{CONDITIONAL_PUT, key, new_value};
+        command.expected_value = expected_value;
+        int output = ReadModifyWrite(command, "CONDITIONAL PUT");
+        return output < 0 ? -1 : 0;
+    }
+
+    // Adds delta to the value of the key (starting from 0 if it doesn't exist), and returns the new value, which can't
+    // be negative.
+    int Increment(int key, int delta = 1) {
+        cout << "STARTING INCREMENT OF KEY " << key << " BY " << delta << endl;
+        return ReadModifyWrite({INCREMENT, key, delta}, "INCREMENT");
+    }
+
+    // Writes the value to the key unless it already exists, and returns the value that the key has afterwards.
+    int PutIfAbsent(int key, int value) {
+        cout << "STARTING PUT IF ABSENT OF PAIR (" << key << ", " << value << ")" << endl;
+        if (value < 0) {
+            cout << "Key and value must be both nonnegative" << endl;
+            cout << "PUT IF ABSENT FAILED" << endl << endl << endl;
+            return -1;
+        }
+        return ReadModifyWrite({PUT_IF_ABSENT, key, value}, "PUT IF ABSENT");
+    }
+
+    // Starts a transaction coordinated by the gateway node, and returns its id. Passing the id to Insert, Get, Update and
+    // Remove runs them inside the transaction, whose writes only become visible to other commands (all of them at
+    // once) if CommitTransaction succeeds, and are discarded by AbortTransaction.
+    long long BeginTransaction() {
+        cout << "STARTING TRANSACTION" << endl;
+        auto chosen_node = get_gateway_node_id();
+        if (chosen_node < 0) {
+            cout << "TRANSACTION FAILED TO START" << endl << endl << endl;
+            return -1;
+        }
+        auto transaction_id = nodes_map_[chosen_node]->BeginTransaction(settings_.one_phase_commit,
+                                                                      settings_.parallel_commits,
+                                                                      settings_.write_pipelining);
+        cout << "TRANSACTION " << transaction_id << " STARTED" << endl << endl << endl;
+        return transaction_id;
+    }
+
+    // Starts a read-only transaction, whose reads all see the store as of the same timestamp: the given one, or
+    // FollowerReadTimestamp() if none is given, so that the closest replica can serve them. Its reads take no locks,
+    // and they aren't recorded in the timestamp cache if they are at or below the closed timestamp of their Range.
+    // Returns -1 if the timestamp is in the future.
+    long long BeginReadOnlyTransaction(Timestamp timestamp = 0) {
+        cout << "STARTING READ-ONLY TRANSACTION" << endl;
+        if ((double) WallTime(timestamp) > (double) clock_.Now() * TICK_DURATION_MS) {
+            cout << "Cannot read at a timestamp in the future" << endl << endl << endl;
+            return -1;
+        }
+        if (timestamp == 0) timestamp = FollowerReadTimestamp();
+        int gateway_id = get_gateway_node_id();
+        if (gateway_id < 0) {
+            cout << "TRANSACTION FAILED TO START" << endl << endl << endl;
+            return -1;
+        }
+        auto transaction_id = nodes_map_[gateway_id]->BeginReadOnlyTransaction(timestamp);
+        cout << "TRANSACTION " << transaction_id << " STARTED" << endl << endl << endl;
+        return transaction_id;
+    }
+
+    int CommitTransaction(long long transaction_id) {
+        return EndTransaction(transaction_id, true);
+    }
+
+    int AbortTransaction(long long transaction_id) {
+        return EndTransaction(transaction_id, false);
+    }
+
+    // Advances the simulated clock, running the background queues and starting a new window for measuring load.
+    void Tick() {
+        operations_since_tick_ = 0;
+        clock_.Advance();
+        for (const auto &[_, node] : nodes_map_) node->HeartbeatLiveness();
+        AcquireInvalidLeases();
+        for (const auto &[_, node] : nodes_map_) node->PublishClosedTimestamps();
+        for (const auto &[_, node] : nodes_map_) node->RecoverTransactions();
+        RunGCQueue();
+
+        int max_load = 0;
+        for (const auto &[_, node_load] : NodeLoad()) {
+            requests_served_ += node_load;
+            max_load = max(max_load, node_load);
+        }
+        busy_time_ += (double) max_load / NODE_CAPACITY;
+
+        // Merges run first, so that the Ranges created by a split, which have not received any load yet, are not merged
+        // back right away.
+        if (settings_.range_merging) RunMergeQueue();
+        if (settings_.load_based_splitting) RunSplitQueue();
+        ApplyZoneConfigs();
+        if (settings_.replica_rebalancing) RunReplicateQueue();
+        if (settings_.lease_rebalancing) RunLeaseRebalancer();
+        RunLeasePlacement();
+        if (settings_.colocate_leaseholder_and_leader) ColocateLeadersWithLeaseholders();
+        RemoveDecommissionedNodes();
+        for (const auto &[_, node] : nodes_map_) node->ResetRangeLoad();
+    }
+
+    // Every node in the same region, each one in its own zone.
+    static vector<Locality> DefaultLocalities(int number_of_nodes) {
+        vector<Locality> localities(number_of_nodes);
+        for (int i = 0; i < number_of_nodes; i++) localities[i].zone = "zone-" + to_string(i);
+        return localities;
+    }
+
+    // Adds an empty node to the cluster and returns its id. The replicate queue and the lease rebalancer will then
+    // start moving replicas and leases to it. Without a zone, the node gets a zone of its own.
+    int AddNode(Locality locality = {}) {
+        int node_id = next_node_id_++;
+        if (locality.zone.empty()) locality.zone = "zone-" + to_string(node_id);
+        cout << "Node " << node_id << " joined the cluster (" << ToString(locality) << ")" << endl;
+        nodes_map_[node_id] =
+                new Node{node_id, interval_start_to_range_descriptor_, &network_, &liveness_, &clock_, locality};
+        total_nodes_++;
+        AssignNodes();
+        return node_id;
+    }
+
+    // Starts removing a node from the cluster. Its leases and leaderships are moved away right away, and its replicas
+    // are then moved to other nodes by the replicate queue, after which the node is removed. Returns -1 if the node
+    // doesn't exist or if removing it would leave fewer nodes than the replicas of some Range.
+    int Decommission(int node_id) {
+        if (!nodes_map_.contains(node_id) || decommissioning_nodes_.contains(node_id)) return -1;
+        int max_replicas = 0;
+        for (const auto &[_, config] : span_start_to_zone_config_) max_replicas = max(max_replicas, config.num_replicas);
+        if (total_nodes_ - (int) decommissioning_nodes_.size() <= max_replicas) {
+            cout << "Cannot decommission node " << node_id << " without under-replicating ranges" << endl;
+            return -1;
+        }
+
+        cout << "Decommissioning node " << node_id << endl;
+        decommissioning_nodes_.insert(node_id);
+        DrainNode(node_id);
+        return 0;
+    }
+
+    // Makes clients reach the cluster through the given node, as if they were located next to it. -1 goes back to
+    // picking a random node for each request.
+    void SetGateway(int node_id) {
+        gateway_id_ = node_id;
+    }
+
+    // Sets the nodes on which the lease of a Range should be placed, in order of preference. Returns -1 if the Range
+    // doesn't exist.
+    int SetLeasePreferences(int range_id, const vector<int> &preferred_node_ids) {
+        for (auto &[_, descriptor] : interval_start_to_range_descriptor_) {
+            if (descriptor.id != range_id) continue;
+            descriptor.lease_preferences = preferred_node_ids;
+            GossipRangeDescriptors();
+            return 0;
+        }
+        return -1;
+    }
+
+    // Sets the zone config of the keys in [start, end], splitting the Ranges at the boundaries of the span. The replicate
+    // queue then adds, removes or moves replicas to satisfy it. Returns -1 if the span or the number of replicas is not
+    // valid, or if the GC TTL is so short that followers couldn't serve reads at their closed timestamp.
+    int SetZoneConfig(int start, int end, const ZoneConfig &config) {
+        if (start < 0 || end > MAX_KEY || start > end) return -1;
+        if (config.num_voters < 0 || config.num_voters > config.num_replicas || NumVoters(config) < 3) return -1;
+        if (config.gc_ttl <= CLOSED_TIMESTAMP_TARGET) return -1;
+        if (config.num_replicas > total_nodes_ - (int) decommissioning_nodes_.size()) return -1;
+
+        // The keys after the span keep the zone config they had.
+        if (end < MAX_KEY) {
+            span_start_to_zone_config_[end + 1] = prev(span_start_to_zone_config_.upper_bound(end + 1))->second;
+        }
+        span_start_to_zone_config_.erase(span_start_to_zone_config_.upper_bound(start),
+                                         span_start_to_zone_config_.upper_bound(end));
+        span_start_to_zone_config_[start] = config;
+        print_zone_config(start, end, config);
+
+        SplitAt(start);
+        SplitAt(end + 1);
+        // Preferences resolved from the previous zone config don't apply anymore.
+        for (auto &[range_start, descriptor] : interval_start_to_range_descriptor_) {
+            if (range_start >= start && range_start <= end) descriptor.lease_preferences.clear();
+        }
+        GossipRangeDescriptors();
+        ApplyZoneConfigs();
+        return 0;
+    }
+
+    // Moves the lease of a Range to another of its replicas. Returns -1 if the Range doesn't exist or the target can't
+    // hold its lease.
+    int RequestLeaseTransfer(int range_id, int target_id) {
+        for (auto &[_, descriptor] : interval_start_to_range_descriptor_) {
+            if (descriptor.id != range_id) continue;
+            if (!descriptor.replicas_id.contains(target_id) || !CanReceiveLease(target_id)) return -1;
+            if (descriptor.leaseholder_id == target_id) return 0;
+            TransferLease(descriptor, target_id);
+            GossipRangeDescriptors();
+            return 0;
+        }
+        return -1;
+    }
+
+    // Simulates a node crash. The node stops heartbeating, and its leases are acquired by other replicas once its
+    // liveness record expires.
+    void StopNode(int node_id) {
+        if (!nodes_map_.contains(node_id)) return;
+        cout << "Node " << node_id << " stopped" << endl;
+        nodes_map_[node_id]->SetLive(false);
+    }
+
+    // Simulates a node crashing in the middle of the next parallel commit it coordinates, right after the STAGING record
+    // and the intents of the transaction were written. The transaction is recovered once the liveness record of the
+    // node expires.
+    void StopNodeDuringCommit(int node_id) {
+        if (!nodes_map_.contains(node_id)) return;
+        nodes_map_[node_id]->CrashDuringNextCommit();
+    }
+
+    // Brings a stopped node back. Its replicas missed the commands committed while it was down, so they catch up with a
+    // snapshot from the leaseholder of each Range.
+    void RestartNode(int node_id) {
+        if (!nodes_map_.contains(node_id) || nodes_map_[node_id]->IsLive()) return;
+        cout << "Node " << node_id << " restarted" << endl;
+        auto node = nodes_map_[node_id];
+        node->SetLive(true);
+        node->HeartbeatLiveness();
+        for (const auto &[_, descriptor] : interval_start_to_range_descriptor_) {
+            bool is_replica = descriptor.replicas_id.contains(node_id) || descriptor.non_voters_id.contains(node_id);
+            if (!is_replica || descriptor.leaseholder_id == node_id) continue;
+            auto leaseholder = nodes_map_[descriptor.leaseholder_id];
+            node->ClearRange(descriptor.start, descriptor.end);
+            node->ApplySnapshot(leaseholder->GetSnapshot(descriptor.start, descriptor.end));
+            node->ForwardAppliedIndex(descriptor.id, leaseholder->GetAppliedIndex(descriptor.id));
+        }
+    }
+
+    // Most recent timestamp that every replica is guaranteed to have closed, since closed timestamps are published once
+    // per tick.
+    [[nodiscard]] Timestamp FollowerReadTimestamp() const {
+        return ::FollowerReadTimestamp(clock_.Now());
+    }
+
+    // Number of reads served by followers so far.
+    [[nodiscard]] long long FollowerReads() const {
+        long long follower_reads = 0;
+        for (const auto &[_, node] : nodes_map_) follower_reads += node->FollowerReads();
+        return follower_reads;
+    }
+
+    // Time each key was locked by a transaction while some command wanted it, in milliseconds, so that hot keys can be
+    // found.
+    [[nodiscard]] map<int, double> Contention() const {
+        map<int, double> contention;
+        for (const auto &[_, node] : nodes_map_) {
+            for (const auto &[key, milliseconds] : node->Contention()) contention[key] += milliseconds;
+        }
+        return contention;
+    }
+
+    // Number of liveness heartbeats sent so far. Each node heartbeats once per tick regardless of how many leases it
+    // holds.
+    [[nodiscard]] long long LivenessHeartbeats() const {
+        return liveness_.Heartbeats();
+    }
+
+    // Whether the node is still part of the cluster (including while being decommissioned).
+    [[nodiscard]] bool HasNode(int node_id) const {
+        return nodes_map_.contains(node_id);
+    }
+
+    // Starts a new window for measuring throughput.
+    void ResetThroughput() {
+        requests_served_ = 0;
+        busy_time_ = 0;
+    }
+
+    ClusterSettings &Settings() {
+        return settings_;
+    }
+
+    [[nodiscard]] const SimulatedNetwork &Network() const {
+        return network_;
+    }
+
+    [[nodiscard]] const map<int, RangeDescriptor> &GetRangeDescriptors() const {
+        return interval_start_to_range_descriptor_;
+    }
+
+    // Simulated time needed to serve the requests since the last ResetThroughput (see Throughput).
+    [[nodiscard]] double BusyTime() const {
+        return busy_time_;
+    }
+
+    // Requests served per unit of simulated time. Since every node serves its requests independently, the time it
+    // takes to serve a tick's worth of requests is determined by the busiest node.
+    [[nodiscard]] double Throughput() const {
+        if (busy_time_ == 0) return 0;
+        return requests_served_ / busy_time_;
+    }
+
     void PrintNodes() {
         for (const auto &[_, node] : nodes_map_) node->Print();
     }
 };
 
 
-int main() {
-    DistributionLayer distribution_layer{5, 3};
+// Silences the output of the simulation while in scope, so that benchmarks only print their results.
+class QuietOutput {
+public:
+    QuietOutput() {
+        cout.setstate(ios_base::failbit);
+    }
+
+    ~QuietOutput() {
+        cout.clear();
+    }
+};
+
+// Sends most requests to the Ranges leased by the node that holds the most leases, and compares the throughput of the
+// cluster with and without lease rebalancing.
+void BenchmarkSkewedWorkload() {
+    const int operations = 2000;
+    const double hot_fraction = 0.9;
+    cout << "Skewed workload (" << operations << " reads, " << hot_fraction * 100
+         << "% of them to the Ranges of the node with the most leases)" << endl;
+
+    for (bool lease_rebalancing : {false, true}) {
+        double throughput;
+        {
+            QuietOutput quiet;
+            DistributionLayer distribution_layer{5, 3};
+            distribution_layer.Settings().load_based_splitting = false;
+            distribution_layer.Settings().range_merging = false;
+            distribution_layer.Settings().replica_rebalancing = false;
+            distribution_layer.Settings().lease_rebalancing = lease_rebalancing;
+
+            map<int, vector<RangeDescriptor>> ranges_by_leaseholder;
+            for (const auto &[_, descriptor] : distribution_layer.GetRangeDescriptors()) {
+                ranges_by_leaseholder[descriptor.leaseholder_id].push_back(descriptor);
+            }
+            vector<RangeDescriptor> hot_ranges;
+            for (const auto &[_, ranges] : ranges_by_leaseholder) {
+                if (ranges.size() > hot_ranges.size()) hot_ranges = ranges;
+            }
+
+            for (int i = 0; i < operations; i++) {
+                int key = rand() % (MAX_KEY + 1);
+                if (rand() < hot_fraction * RAND_MAX) {
+                    auto &range = hot_ranges[rand() % hot_ranges.size()];
+                    key = range.start + rand() % (range.end - range.start + 1);
+                }
+                distribution_layer.Get(key);
+            }
+            throughput = distribution_layer.Throughput();
+        }
+        cout << "  lease rebalancing " << (lease_rebalancing ? "on: " : "off:") << " " << throughput
+             << " requests per unit of time" << endl;
+    }
+}
+
+// Runs reads on a fully populated key space while a node joins the cluster and another one is decommissioned, and
+// reports the throughput and the failed reads of each phase. Replica and lease movements should not make any read fail.
+void BenchmarkMembershipChanges() {
+    const int operations_per_phase = 1000;
+    cout << "Membership changes (" << operations_per_phase << " reads per phase, starting with 5 nodes)" << endl;
+
+    vector<tuple<string, double, int>> results;
+    bool removed;
+    {
+        QuietOutput quiet;
+        DistributionLayer distribution_layer{5, 3};
+        for (int key = 0; key <= MAX_KEY; key++) distribution_layer.Insert(key, key);
+
+        auto run_phase = [&](const string &name) {
+            distribution_layer.ResetThroughput();
+            int failed = 0;
+            for (int i = 0; i < operations_per_phase; i++) {
+                if (distribution_layer.Get(rand() % (MAX_KEY + 1)) < 0) failed++;
+            }
+            results.emplace_back(name, distribution_layer.Throughput(), failed);
+        };
+
+        run_phase("steady state");
+        distribution_layer.AddNode();
+        run_phase("node 5 joining");
+        distribution_layer.Decommission(0);
+        run_phase("node 0 decommissioning");
+        removed = !distribution_layer.HasNode(0);
+        run_phase("steady state");
+    }
+
+    for (const auto &[name, throughput, failed] : results) {
+        cout << "  " << name << ": " << throughput << " requests per unit of time, " << failed << " failed reads" << endl;
+    }
+    cout << "  node 0 " << (removed ? "was" : "was not") << " removed after decommissioning" << endl;
+}
+
+// Compares the number of hops and the latency of requests when the leaseholder and the leader of every Range are
+// colocated and when they are always on different nodes.
+void BenchmarkLeaseholderLeaderColocation() {
+    const int operations = 2000;
+    cout << "Leaseholder and leader colocation (" << operations << " operations, half of them writes)" << endl;
+
+    for (bool colocate : {false, true}) {
+        double hops, latency;
+        {
+            QuietOutput quiet;
+            ClusterSettings settings;
+            settings.colocate_leaseholder_and_leader = colocate;
+            DistributionLayer distribution_layer{5, 3, settings};
+            for (int i = 0; i < operations; i++) {
+                int key = rand() % (MAX_KEY + 1);
+                if (i % 2 == 0) distribution_layer.Insert(key, i);
+                else distribution_layer.Get(key);
+            }
+            hops = (double) distribution_layer.Network().Hops() / operations;
+            latency = distribution_layer.Network().TotalLatency() / operations;
+        }
+        cout << "  " << (colocate ? "colocated:  " : "split roles:") << " " << hops << " hops and " << latency
+             << " ms per request" << endl;
+    }
+}
+
+// Sends reads to a single Range while its lease is transferred, and reports the latency of the reads around the
+// transfer for cooperative and non-cooperative transfers.
+void BenchmarkLeaseTransferUnderLoad() {
+    const int operations = 200;
+    cout << "Lease transfer under load (" << operations << " reads on a single Range, transfer after "
+         << operations / 2 << ")" << endl;
+
+    for (bool cooperative : {false, true}) {
+        vector<double> latencies;
+        double transfer_latency;
+        {
+            QuietOutput quiet;
+            ClusterSettings settings;
+            settings.load_based_splitting = false;
+            settings.range_merging = false;
+            settings.lease_rebalancing = false;
+            settings.replica_rebalancing = false;
+            settings.cooperative_lease_transfers = cooperative;
+            DistributionLayer distribution_layer{5, 3, settings};
+            auto range = distribution_layer.GetRangeDescriptors().begin()->second;
+            for (int key = range.start; key <= range.end; key++) distribution_layer.Insert(key, key);
+
+            for (int i = 0; i < operations; i++) {
+                if (i == operations / 2) {
+                    int target_id = *range.replicas_id.begin();
+                    for (auto replica_id : range.replicas_id) {
+                        if (replica_id != range.leaseholder_id && replica_id != range.leader_id) target_id = replica_id;
+                    }
+                    double before = distribution_layer.Network().TotalLatency();
+                    distribution_layer.RequestLeaseTransfer(range.id, target_id);
+                    transfer_latency = distribution_layer.Network().TotalLatency() - before;
+                }
+                double before = distribution_layer.Network().TotalLatency();
+                distribution_layer.Get(range.start + rand() % (range.end - range.start + 1));
+                latencies.push_back(distribution_layer.Network().TotalLatency() - before);
+            }
+        }
+
+        double baseline = *max_element(latencies.begin(), latencies.begin() + operations / 2);
+        int affected = (int) count_if(latencies.begin(), latencies.end(), [&](double l) { return l > baseline; });
+        cout << "  " << (cooperative ? "cooperative:    " : "non-cooperative:") << " transfer took "
+             << transfer_latency << " ms, max read latency " << *max_element(latencies.begin(), latencies.end())
+             << " ms (" << baseline << " ms before the transfer), " << affected << " reads slowed down" << endl;
+    }
+}
+
+// Sends every request through a single gateway node, as if all clients were next to it, and compares the number of
+// hops and the latency of requests with and without follow-the-workload.
+void BenchmarkFollowTheWorkload() {
+    const int operations = 2000;
+    cout << "Follow-the-workload (" << operations << " reads, all of them through node 0)" << endl;
+
+    for (bool follow_the_workload : {false, true}) {
+        double hops, latency;
+        {
+            QuietOutput quiet;
+            ClusterSettings settings;
+            settings.lease_rebalancing = false;
+            settings.follow_the_workload = follow_the_workload;
+            DistributionLayer distribution_layer{5, 3, settings};
+            distribution_layer.SetGateway(0);
+            for (int i = 0; i < operations; i++) distribution_layer.Get(rand() % (MAX_KEY + 1));
+            hops = (double) distribution_layer.Network().Hops() / operations;
+            latency = distribution_layer.Network().TotalLatency() / operations;
+        }
+        cout << "  follow-the-workload " << (follow_the_workload ? "on: " : "off:") << " " << hops << " hops and "
+             << latency << " ms per request" << endl;
+    }
+}
+
+// Regions of the clusters used by the benchmarks that place nodes in several regions.
+const char *const BENCHMARK_REGIONS[] = {"us-east", "us-west", "eu-west"};
+
+// Localities of a nine-node cluster with three nodes in each of BENCHMARK_REGIONS, each one in its own zone. Nodes 0-2
+// are in us-east, 3-5 in us-west and 6-8 in eu-west.
+vector<Locality> MakeRegionalCluster() {
+    vector<Locality> localities;
+    for (const char *region : BENCHMARK_REGIONS) {
+        for (const char *zone : {"a", "b", "c"}) localities.push_back({region, string(region) + "-" + zone});
+    }
+    return localities;
+}
+
+// Nine nodes, three in each of three regions, with the clients next to node 0. Compares the latency of writes and
+// the fraction of Ranges that would survive the loss of a whole region with and without locality-aware allocation.
+void BenchmarkRegionalPlacement() {
+    const int operations = 1000;
+    auto localities = MakeRegionalCluster();
+    cout << "Regional placement (" << operations << " writes through node 0, 3 regions with 3 nodes each)" << endl;
+
+    for (bool locality_aware : {false, true}) {
+        double latency;
+        int surviving = 0, total = 0;
+        {
+            QuietOutput quiet;
+            ClusterSettings settings;
+            settings.locality_aware_allocation = locality_aware;
+            DistributionLayer distribution_layer{localities, 3, settings};
+            distribution_layer.SetGateway(0);
+            for (int i = 0; i < operations; i++) {
+                int key = rand() % (MAX_KEY + 1);
+                if (distribution_layer.Insert(key, i) < 0) distribution_layer.Update(key, i);
+            }
+            latency = distribution_layer.Network().TotalLatency() / operations;
+
+            for (const auto &[_, descriptor] : distribution_layer.GetRangeDescriptors()) {
+                total++;
+                bool survives = true;
+                for (const char *region : BENCHMARK_REGIONS) {
+                    int outside = 0;
+                    for (auto replica_id : descriptor.replicas_id) {
+                        if (distribution_layer.Network().GetLocality(replica_id).region != region) outside++;
+                    }
+                    if (outside <= (int) descriptor.replicas_id.size() / 2) survives = false;
+                }
+                if (survives) surviving++;
+            }
+        }
+        cout << "  locality-aware allocation " << (locality_aware ? "on: " : "off:") << " " << latency
+             << " ms per write, " << surviving << "/" << total << " ranges survive the loss of a region" << endl;
+    }
+}
+
+// Seven nodes, with the keys in [0, 19] being a hot table that should survive two node failures and the rest bulk data.
+// Compares replicating everything 5 times with giving 5 replicas to the hot table only through a zone config.
+void BenchmarkZoneConfigs() {
+    const int operations = 1000;
+    cout << "Zone configs (" << operations << " writes, 7 nodes, 5 replicas wanted for the keys in [0, 19])" << endl;
+
+    for (bool zone_configs : {false, true}) {
+        int replicas = 0, hot_replicas = INT_MAX;
+        {
+            QuietOutput quiet;
+            DistributionLayer distribution_layer{7, zone_configs ? 3 : 5};
+            ZoneConfig hot_table;
+            hot_table.num_replicas = 5;
+            if (zone_configs) distribution_layer.SetZoneConfig(0, 19, hot_table);
+            for (int i = 0; i < operations; i++) {
+                int key = rand() % (MAX_KEY + 1);
+                if (distribution_layer.Insert(key, i) < 0) distribution_layer.Update(key, i);
+            }
+
+            for (const auto &[_, descriptor] : distribution_layer.GetRangeDescriptors()) {
+                replicas += (int) descriptor.replicas_id.size();
+                if (descriptor.end <= 19) hot_replicas = min(hot_replicas, (int) descriptor.replicas_id.size());
+            }
+        }
+        cout << "  " << (zone_configs ? "zone config for the hot table:" : "5 replicas everywhere:        ") << " "
+             << replicas << " replicas in total, at least " << hot_replicas << " for each hot Range" << endl;
+    }
+}
+
+// Nine nodes, three in each of three regions, with the clients next to node 0 (in us-east). Every Range keeps a copy in
+// each region, either with five voting replicas spread across regions, or with three voting replicas in us-east and two
+// non-voting replicas elsewhere. Compares the latency of writes once the replicas are in place.
+void BenchmarkNonVotingReplicas() {
+    const int operations = 1000;
+    auto localities = MakeRegionalCluster();
+    cout << "Non-voting replicas (" << operations << " writes through node 0, 5 replicas in 3 regions)" << endl;
+
+    for (bool non_voters : {false, true}) {
+        double latency;
+        int regions = INT_MAX;
+        {
+            QuietOutput quiet;
+            DistributionLayer distribution_layer{localities, 3};
+            distribution_layer.SetGateway(0);
+            ZoneConfig config;
+            config.num_replicas = 5;
+            if (non_voters) {
+                config.num_voters = 3;
+                config.voter_constraints = {{"region", "us-east"}};
+            }
+            distribution_layer.SetZoneConfig(0, MAX_KEY, config);
+            for (int i = 0; i < 10; i++) distribution_layer.Tick();
+
+            double latency_before = distribution_layer.Network().TotalLatency();
+            for (int i = 0; i < operations; i++) {
+                int key = rand() % (MAX_KEY + 1);
+                if (distribution_layer.Insert(key, i) < 0) distribution_layer.Update(key, i);
+            }
+            latency = (distribution_layer.Network().TotalLatency() - latency_before) / operations;
+
+            for (const auto &[_, descriptor] : distribution_layer.GetRangeDescriptors()) {
+                set<string> range_regions;
+                for (auto replica_id : descriptor.replicas_id) {
+                    range_regions.insert(distribution_layer.Network().GetLocality(replica_id).region);
+                }
+                for (auto replica_id : descriptor.non_voters_id) {
+                    range_regions.insert(distribution_layer.Network().GetLocality(replica_id).region);
+                }
+                regions = min(regions, (int) range_regions.size());
+            }
+        }
+        cout << "  " << (non_voters ? "3 voters and 2 non-voters:" : "5 voters:                  ") << " " << latency
+             << " ms per write, every range has replicas in at least " << regions << " regions" << endl;
+    }
+}
+
+// Nine nodes, three in each of three regions, with three voting replicas of every Range in us-east and two non-voting
+// replicas elsewhere, and the clients next to node 6 (in eu-west). Compares the latency of reading the latest values,
+// which must go to the leaseholder in us-east, with that of follower reads.
+void BenchmarkFollowerReads() {
+    const int operations = 1000;
+    auto localities = MakeRegionalCluster();
+    cout << "Follower reads (" << operations << " reads through node 6 in eu-west, voters in us-east)" << endl;
+
+    for (bool follower_reads : {false, true}) {
+        double latency;
+        long long served_by_followers;
+        {
+            QuietOutput quiet;
+            DistributionLayer distribution_layer{localities, 3};
+            ZoneConfig config;
+            config.num_replicas = 5;
+            config.num_voters = 3;
+            config.voter_constraints = {{"region", "us-east"}};
+            distribution_layer.SetZoneConfig(0, MAX_KEY, config);
+            for (int key = 0; key <= MAX_KEY; key++) distribution_layer.Insert(key, key);
+            for (int i = 0; i < 10; i++) distribution_layer.Tick();
+
+            distribution_layer.SetGateway(6);
+            double latency_before = distribution_layer.Network().TotalLatency();
+            for (int i = 0; i < operations; i++) {
+                int key = rand() % (MAX_KEY + 1);
+                if (follower_reads) distribution_layer.Get(key, distribution_layer.FollowerReadTimestamp());
+                else distribution_layer.Get(key);
+            }
+            latency = (distribution_layer.Network().TotalLatency() - latency_before) / operations;
+            served_by_followers = distribution_layer.FollowerReads();
+        }
+        cout << "  " << (follower_reads ? "follower reads:" : "latest values: ") << " " << latency << " ms per read, "
+             << served_by_followers << " reads served by followers" << endl;
+    }
+}
+
+// Hands out timestamps from a single hybrid logical clock on several threads at once, as a busy node would, and
+// compares it with the same clock guarded by a mutex. Also checks that no timestamp was handed out twice.
+void BenchmarkHybridLogicalClock() {
+    const int threads = 4;
+    const int timestamps_per_thread = 1000000;
+    cout << "Hybrid logical clock (" << threads << " threads, " << timestamps_per_thread << " timestamps each)" << endl;
+
+    SimulatedClock clock;
+    HybridLogicalClock hlc{&clock};
+    mutex mutex;
+    Timestamp locked_state = 0;
+    auto locked_now = [&]() {
+        lock_guard<std::mutex> lock{mutex};
+        auto physical = MakeTimestamp((long long) ((double) clock.Now() * TICK_DURATION_MS));
+        locked_state = WallTime(physical) > WallTime(locked_state) ? physical : locked_state + 1;
+        return locked_state;
+    };
+
+    for (bool lock_free : {false, true}) {
+        vector<vector<Timestamp>> timestamps(threads, vector<Timestamp>(timestamps_per_thread));
+        auto start = chrono::steady_clock::now();
+        vector<thread> workers;
+        for (int i = 0; i < threads; i++) {
+            workers.emplace_back([&, i]() {
+                for (auto &timestamp : timestamps[i]) timestamp = lock_free ? hlc.Now() : locked_now();
+            });
+        }
+        for (auto &worker : workers) worker.join();
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        vector<Timestamp> all;
+        for (const auto &thread_timestamps : timestamps) {
+            all.insert(all.end(), thread_timestamps.begin(), thread_timestamps.end());
+        }
+        sort(all.begin(), all.end());
+        bool unique = adjacent_find(all.begin(), all.end()) == all.end();
+        cout << "  " << (lock_free ? "lock-free:" : "mutex:    ") << " "
+             << (double) all.size() / seconds / 1e6 << " million timestamps per second, "
+             << (unique ? "all of them unique" : "some of them repeated") << endl;
+    }
+}
+
+// Records reads and looks up writes on a single timestamp cache from several threads at once, as a busy leaseholder
+// would, with a single shard (one lock) and with TIMESTAMP_CACHE_SHARDS shards.
+void BenchmarkTimestampCache() {
+    const int threads = 4;
+    const int operations_per_thread = 200000;
+    const int keys = 10000;
+    cout << "Timestamp cache (" << threads << " threads, " << operations_per_thread
+         << " operations each, half of them reads)" << endl;
+
+    for (int shards : {1, TIMESTAMP_CACHE_SHARDS}) {
+        TimestampCache timestamp_cache{shards};
+        atomic<Timestamp> next_timestamp{1};
+        auto start = chrono::steady_clock::now();
+        vector<thread> workers;
+        for (int i = 0; i < threads; i++) {
+            workers.emplace_back([&, i]() {
+                mt19937 random{(unsigned) i};
+                for (int j = 0; j < operations_per_thread; j++) {
+                    int key = (int) (random() % keys);
+                    if (j % 2 == 0) timestamp_cache.Add(key, key, next_timestamp++);
+                    else timestamp_cache.Lookup(key, key);
+                }
+            });
+        }
+        for (auto &worker : workers) worker.join();
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout << "  " << setw(2) << shards << " shard" << (shards == 1 ? ": " : "s:") << " "
+             << threads * operations_per_thread / seconds / 1e6 << " million operations per second, "
+             << timestamp_cache.Size() << " spans kept" << endl;
+    }
+}
+
+// Evaluates commands on a single Range from many client threads, each command holding its latch while it is evaluated
+// and replicated (simulated by sleeping), either latching the whole Range (one command at a time) or only its own key.
+void BenchmarkLatchManager() {
+    const int threads = 16;
+    const int commands_per_thread = 100;
+    const int keys = 100;
+    const auto evaluation_time = chrono::microseconds(200);
+    cout << "Latch manager (" << threads << " clients, " << commands_per_thread << " commands each on " << keys
+         << " keys, half of them writes)" << endl;
+
+    for (bool per_key : {false, true}) {
+        LatchManager latch_manager;
+        auto start = chrono::steady_clock::now();
+        vector<thread> workers;
+        for (int i = 0; i < threads; i++) {
+            workers.emplace_back([&, i]() {
+                mt19937 random{(unsigned) i};
+                for (int j = 0; j < commands_per_thread; j++) {
+                    int key = (int) (random() % keys);
+                    auto access = j % 2 == 0 ? WRITE_LATCH : READ_LATCH;
+                    Latch latch = per_key ? Latch{key, key, access} : Latch{0, keys - 1, WRITE_LATCH};
+                    LatchGuard guard{&latch_manager, latch};
+                    this_thread::sleep_for(evaluation_time);
+                }
+            });
+        }
+        for (auto &worker : workers) worker.join();
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout << "  " << (per_key ? "per-key latches:" : "range latch:    ") << " "
+             << threads * commands_per_thread / seconds << " commands per second, " << latch_manager.Waits()
+             << " of them waited for a latch" << endl;
+    }
+}
+
+// Settings of the clusters used by the transaction benchmarks, with every setting that decides how transactions commit
+// pinned, so that each benchmark only measures the ones it compares.
+ClusterSettings MakeTransactionSettings(bool one_phase_commit, bool parallel_commits, bool write_pipelining) {
+    ClusterSettings settings;
+    settings.one_phase_commit = one_phase_commit;
+    settings.parallel_commits = parallel_commits;
+    settings.write_pipelining = write_pipelining;
+    return settings;
+}
+
+struct TransactionWorkloadResult {
+    // Latency per transaction, from its first write until it commits, and that of committing it, in milliseconds.
+    double latency;
+    double commit_latency;
+    // Transactions per unit of time that the nodes spent processing them.
+    double throughput;
+    int committed;
+};
+
+// Runs transactions that update writes_per_transaction keys each on a five-node cluster with the given settings, whose
+// Ranges are kept fixed so that every transaction touches the intended number of them. The j-th key written by the
+// i-th transaction is key(range_starts, i, j), where range_starts are the first keys of the Ranges.
+TransactionWorkloadResult RunTransactionWorkload(ClusterSettings settings, int transactions, int writes_per_transaction,
+                                                 const function<int(const vector<int> &, int, int)> &key) {
+    TransactionWorkloadResult result{0, 0, 0, 0};
+    QuietOutput quiet;
+    settings.load_based_splitting = false;
+    settings.range_merging = false;
+    DistributionLayer distribution_layer{5, 3, settings};
+    for (int k = 0; k <= MAX_KEY; k++) distribution_layer.Insert(k, k);
+    vector<int> range_starts;
+    for (const auto &[start, _] : distribution_layer.GetRangeDescriptors()) range_starts.push_back(start);
+
+    distribution_layer.ResetThroughput();
+    double latency_before = distribution_layer.Network().TotalLatency();
+    for (int i = 0; i < transactions; i++) {
+        auto transaction_id = distribution_layer.BeginTransaction();
+        for (int j = 0; j < writes_per_transaction; j++) {
+            distribution_layer.Update(key(range_starts, i, j), i, transaction_id);
+        }
+        double commit_before = distribution_layer.Network().TotalLatency();
+        if (distribution_layer.CommitTransaction(transaction_id) >= 0) result.committed++;
+        result.commit_latency += distribution_layer.Network().TotalLatency() - commit_before;
+    }
+    result.latency = (distribution_layer.Network().TotalLatency() - latency_before) / transactions;
+    result.commit_latency /= transactions;
+    result.throughput = transactions / distribution_layer.BusyTime();
+    return result;
+}
+
+// Keys of transactions that write the first keys of the same Range.
+int SingleRangeKey(const vector<int> &range_starts, int transaction, int write) {
+    return range_starts[transaction % range_starts.size()] + write;
+}
+
+// Keys of transactions that write the first key of consecutive Ranges.
+int CrossRangeKey(const vector<int> &range_starts, int transaction, int write) {
+    return range_starts[(transaction + write) % range_starts.size()];
+}
+
+// Runs transactions that update several keys, either all of them in the same Range or each one in a different Range,
+// and measures their latency (from their first write until they commit) and that of committing them.
+void BenchmarkTransactions() {
+    const int transactions = 200;
+    const int writes_per_transaction = 4;
+    cout << "Transactions (" << transactions << " transactions of " << writes_per_transaction << " writes each)"
+         << endl;
+
+    for (bool cross_range : {false, true}) {
+        auto result = RunTransactionWorkload(MakeTransactionSettings(false, false, false), transactions,
+                                             writes_per_transaction, cross_range ? CrossRangeKey : SingleRangeKey);
+        cout << "  " << (cross_range ? "cross-range: " : "single-range:") << " " << result.latency
+             << " ms per transaction (" << result.commit_latency << " ms to commit), " << result.committed
+             << " committed" << endl;
+    }
+}
+
+// Runs transactions that update several keys of the same Range, committing them with the general protocol (intents, a
+// transaction record and intent resolution) or in one phase, and measures their latency and how many of them the
+// cluster can serve per unit of time.
+void BenchmarkOnePhaseCommit() {
+    const int transactions = 200;
+    const int writes_per_transaction = 4;
+    cout << "One-phase commit (" << transactions << " single-range transactions of " << writes_per_transaction
+         << " writes each)" << endl;
+
+    for (bool one_phase_commit : {false, true}) {
+        auto result = RunTransactionWorkload(MakeTransactionSettings(one_phase_commit, false, false), transactions,
+                                             writes_per_transaction, SingleRangeKey);
+        cout << "  " << (one_phase_commit ? "one-phase commit:" : "general protocol:") << " " << result.latency
+             << " ms per transaction, " << result.throughput << " transactions per unit of time, " << result.committed
+             << " committed" << endl;
+    }
+}
+
+// Runs transactions that update one key in each of several Ranges, committing them with the general protocol (intents
+// first, then the record) or with parallel commits (the record in parallel with proving the pipelined writes), and
+// measures their latency. Then crashes the coordinator of a transaction in the middle of a parallel commit, and
+// measures how long it takes for the transaction to be recovered.
+// Finally, a transaction reads key 5 and writes key 55, another client reads 55 (pushing the transaction above its
+// read) and overwrites 5, and the transaction reads 55 again and writes key 95. Its reads no longer hold at the
+// timestamp at which it would commit, so the parallel commit must be refused.
+void BenchmarkParallelCommits() {
+    const int transactions = 200;
+    const int writes_per_transaction = 4;
+    cout << "Parallel commits (" << transactions << " cross-range transactions of " << writes_per_transaction
+         << " writes each)" << endl;
+
+    for (bool parallel_commits : {false, true}) {
+        auto result = RunTransactionWorkload(MakeTransactionSettings(false, parallel_commits, false), transactions,
+                                             writes_per_transaction, CrossRangeKey);
+        cout << "  " << (parallel_commits ? "parallel commits:" : "general protocol:") << " " << result.latency
+             << " ms per transaction (" << result.commit_latency << " ms to commit), " << result.committed
+             << " committed" << endl;
+    }
+
+    int ticks = 0;
+    bool recovered;
+    {
+        QuietOutput quiet;
+        DistributionLayer distribution_layer{5, 3, MakeTransactionSettings(false, true, false)};
+        for (int key = 0; key <= MAX_KEY; key++) distribution_layer.Insert(key, key);
+        distribution_layer.SetGateway(0);
+        auto transaction_id = distribution_layer.BeginTransaction();
+        for (int key : {5, 55}) distribution_layer.Update(key, 1000, transaction_id);
+        distribution_layer.StopNodeDuringCommit(0);
+        distribution_layer.CommitTransaction(transaction_id);
+        // Both keys keep an intent until the transaction is recovered.
+        while (ticks < 50 && (distribution_layer.Get(5) < 0 || distribution_layer.Get(55) < 0)) {
+            distribution_layer.Tick();
+            ticks++;
+        }
+        recovered = distribution_layer.Get(5) == 1000 && distribution_layer.Get(55) == 1000;
+    }
+    cout << "  coordinator crashed mid-commit: " << (recovered ? "committed" : "not committed") << " by recovery after "
+         << ticks << " ticks" << endl;
+
+    int stale_commit;
+    {
+        QuietOutput quiet;
+        DistributionLayer distribution_layer{5, 3, MakeTransactionSettings(false, true, false)};
+        for (int key = 0; key <= MAX_KEY; key++) distribution_layer.Insert(key, 1);
+        auto transaction_id = distribution_layer.BeginTransaction();
+        distribution_layer.Get(5, 0, transaction_id);
+        distribution_layer.Update(55, 2, transaction_id);
+        distribution_layer.Get(55);
+        distribution_layer.Update(5, 999);
+        distribution_layer.Get(55, 0, transaction_id);
+        distribution_layer.Update(95, 3, transaction_id);
+        stale_commit = distribution_layer.CommitTransaction(transaction_id);
+    }
+    cout << "  pushed above its reads before staging: " << (stale_commit < 0 ? "aborted" : "COMMITTED ON STALE READS")
+         << endl;
+}
+
+// Runs transactions that write several keys in different Ranges without buffering their writes (so neither one-phase
+// commit nor parallel commits apply), either waiting for each write to replicate or pipelining them.
+// Then, a pipelined write is sent to a Range whose followers are down, so it is answered but never replicated, and the
+// outcome of committing its transaction is reported.
+void BenchmarkWritePipelining() {
+    const int transactions = 200;
+    const int writes_per_transaction = 4;
+    cout << "Write pipelining (" << transactions << " cross-range transactions of " << writes_per_transaction
+         << " writes each)" << endl;
+
+    for (bool write_pipelining : {false, true}) {
+        auto result = RunTransactionWorkload(MakeTransactionSettings(false, false, write_pipelining), transactions,
+                                             writes_per_transaction, CrossRangeKey);
+        cout << "  " << (write_pipelining ? "pipelined:   " : "synchronous: ") << " " << result.latency
+             << " ms per transaction (" << result.commit_latency << " ms to commit), " << result.committed
+             << " committed" << endl;
+    }
+
+    int write_result, commit_result;
+    {
+        QuietOutput quiet;
+        auto settings = MakeTransactionSettings(false, false, true);
+        settings.colocate_leaseholder_and_leader = true;
+        DistributionLayer distribution_layer{5, 3, settings};
+        for (int key = 0; key <= MAX_KEY; key++) distribution_layer.Insert(key, key);
+        auto descriptor = distribution_layer.GetRangeDescriptors().begin()->second;
+        distribution_layer.SetGateway(descriptor.leaseholder_id);
+        auto transaction_id = distribution_layer.BeginTransaction();
+        for (auto replica_id : descriptor.replicas_id) {
+            if (replica_id != descriptor.leaseholder_id) distribution_layer.StopNode(replica_id);
+        }
+        write_result = distribution_layer.Update(descriptor.start, 1000, transaction_id);
+        commit_result = distribution_layer.CommitTransaction(transaction_id);
+    }
+    cout << "  write lost during replication: " << (write_result >= 0 ? "answered" : "failed") << ", commit "
+         << (commit_result >= 0 ? "succeeded" : "aborted after failing to prove it") << endl;
+}
+
+// Runs reports that read a span of keys, while a transaction that read one of those keys before the report started
+// increments it. The report is either a regular transaction, whose reads push the write of the increment above the
+// timestamp at which it read (so it must be retried), or a read-only transaction at the follower read timestamp.
+void BenchmarkReadOnlyTransactions() {
+    const int rounds = 100;
+    const int report_keys = 20;
+    cout << "Read-only transactions (" << rounds << " reports of " << report_keys << " keys, each one concurrent with "
+         << "an increment of one of them)" << endl;
+
+    for (bool read_only : {false, true}) {
+        double report_latency = 0;
+        int failed_reads = 0;
+        int aborted = 0;
+        {
+            QuietOutput quiet;
+            ClusterSettings settings;
+            settings.load_based_splitting = false;
+            settings.range_merging = false;
+            DistributionLayer distribution_layer{5, 3, settings};
+            for (int key = 0; key <= MAX_KEY; key++) distribution_layer.Insert(key, key);
+            for (int i = 0; i < 10; i++) distribution_layer.Tick();
+            for (int i = 0; i < rounds; i++) {
+                // The increment reads its key before the report starts, and writes it once the report has read it.
+                int incremented_key = i % report_keys;
+                auto increment_id = distribution_layer.BeginTransaction();
+                int value = distribution_layer.Get(incremented_key, 0, increment_id);
+
+                double latency_before = distribution_layer.Network().TotalLatency();
+                auto report_id = read_only ? distribution_layer.BeginReadOnlyTransaction()
+                                           : distribution_layer.BeginTransaction();
+                for (int j = 0; j < report_keys; j++) {
+                    int key = (incremented_key + j) % report_keys;
+                    if (distribution_layer.Get(key, 0, report_id) < 0) failed_reads++;
+                    if (j > 0) continue;
+                    double increment_before = distribution_layer.Network().TotalLatency();
+                    distribution_layer.Update(incremented_key, value + 1, increment_id);
+                    if (distribution_layer.CommitTransaction(increment_id) < 0) aborted++;
+                    latency_before += distribution_layer.Network().TotalLatency() - increment_before;
+                }
+                distribution_layer.CommitTransaction(report_id);
+                report_latency += distribution_layer.Network().TotalLatency() - latency_before;
+            }
+        }
+        cout << "  " << (read_only ? "read-only:  " : "read-write: ") << " " << report_latency / rounds
+             << " ms per report, " << failed_reads << " failed reads, " << aborted << " increments aborted" << endl;
+    }
+}
+
+// Two clients increment the same counters at the same time, in pairs: either both read the counter and then both write
+// it back incremented, or both send an Increment, which the leaseholder evaluates. Reports the hops and latency of each
+// increment, and how many increments were lost. Then checks that an increment that would overflow the counter is
+// rejected and leaves it as it was.
+void BenchmarkReadModifyWrite() {
+    const int increments = 1000;
+    const int counters = 10;
+    cout << "Read-modify-write (" << increments << " increments of " << counters << " counters by 2 clients)" << endl;
+
+    for (bool increment : {false, true}) {
+        double hops, latency;
+        int total = 0;
+        {
+            QuietOutput quiet;
+            DistributionLayer distribution_layer{5, 3};
+            for (int key = 0; key < counters; key++) distribution_layer.Insert(key, 0);
+            long long hops_before = distribution_layer.Network().Hops();
+            double latency_before = distribution_layer.Network().TotalLatency();
+            for (int i = 0; i < increments; i += 2) {
+                int key = rand() % counters;
+                if (increment) {
+                    distribution_layer.Increment(key);
+                    distribution_layer.Increment(key);
+                } else {
+                    int first = distribution_layer.Get(key);
+                    int second = distribution_layer.Get(key);
+                    distribution_layer.Update(key, first + 1);
+                    distribution_layer.Update(key, second + 1);
+                }
+            }
+            hops = (double) (distribution_layer.Network().Hops() - hops_before) / increments;
+            latency = (distribution_layer.Network().TotalLatency() - latency_before) / increments;
+            for (int key = 0; key < counters; key++) total += distribution_layer.Get(key);
+        }
+        cout << "  " << (increment ? "increment:     " : "get and update:") << " " << hops << " hops and " << latency
+             << " ms per increment, " << increments - total << " increments lost" << endl;
+    }
+
+    bool overflow_rejected;
+    {
+        QuietOutput quiet;
+        DistributionLayer distribution_layer{5, 3};
+        distribution_layer.Insert(0, INT_MAX - 1);
+        overflow_rejected = distribution_layer.Increment(0, 2) < 0 && distribution_layer.Get(0) == INT_MAX - 1;
+    }
+    cout << "  overflowing increment: " << (overflow_rejected ? "rejected" : "NOT REJECTED") << endl;
+}
+
+// Backs up a table after each transaction that rewrites all of its keys with the same value, either scanning the latest
+// values or scanning as of the follower read timestamp, through a gateway in eu-west while the voters are in us-east.
+// Checks that every backup saw the same value in every key (a consistent snapshot), and that once the versions the
+// first backup read have been garbage collected, scanning as of its timestamp is rejected.
+void BenchmarkTimeTravelScans() {
+    const int rounds = 100;
+    const int table_keys = 20;
+    auto localities = MakeRegionalCluster();
+    cout << "Time-travel scans (" << rounds << " backups of " << table_keys << " keys through node 6 in eu-west, "
+         << "voters in us-east)" << endl;
+
+    for (bool historical : {false, true}) {
+        double latency = 0;
+        int consistent = 0;
+        long long served_by_followers;
+        bool gc_rejected;
+        {
+            QuietOutput quiet;
+            ClusterSettings settings;
+            settings.load_based_splitting = false;
+            settings.range_merging = false;
+            DistributionLayer distribution_layer{localities, 3, settings};
+            ZoneConfig config;
+            config.num_replicas = 5;
+            config.num_voters = 3;
+            config.voter_constraints = {{"region", "us-east"}};
+            distribution_layer.SetZoneConfig(0, MAX_KEY, config);
+            for (int key = 0; key <= MAX_KEY; key++) distribution_layer.Insert(key, 0);
+            for (int i = 0; i < 10; i++) distribution_layer.Tick();
+
+            distribution_layer.SetGateway(6);
+            Timestamp first_backup_timestamp = distribution_layer.FollowerReadTimestamp();
+            for (int i = 0; i < rounds; i++) {
+                auto transaction_id = distribution_layer.BeginTransaction();
+                for (int key = 0; key < table_keys; key++) distribution_layer.Update(key, i + 1, transaction_id);
+                distribution_layer.CommitTransaction(transaction_id);
+
+                double latency_before = distribution_layer.Network().TotalLatency();
+                map<int, int> rows;
+                Timestamp timestamp = historical ? distribution_layer.FollowerReadTimestamp() : 0;
+                bool scanned = distribution_layer.Scan(0, table_keys - 1, timestamp, &rows) == table_keys;
+                latency += distribution_layer.Network().TotalLatency() - latency_before;
+                if (scanned && all_of(rows.begin(), rows.end(), [&](const auto &row) {
+                    return row.second == rows.begin()->second;
+                })) {
+                    consistent++;
+                }
+            }
+            served_by_followers = distribution_layer.FollowerReads();
+            gc_rejected = distribution_layer.Scan(0, table_keys - 1, first_backup_timestamp) < 0;
+        }
+        cout << "  " << (historical ? "as of follower read timestamp:" : "latest values:               ") << " "
+             << latency / rounds << " ms per backup, " << consistent << " consistent, " << served_by_followers
+             << " Range scans served by followers" << endl;
+        if (historical) {
+            cout << "  scan as of the first backup after " << rounds << " rewrites: "
+                 << (gc_rejected ? "rejected, below the GC threshold" : "served") << endl;
+        }
+    }
+}
+
+// A microbenchmark of the LockTable alone, outside of the cluster (whose nodes evaluate one command at a time, so
+// their commands never block in it): runs transactions that lock two random keys out of a small set from several
+// threads, either retrying from the client whenever a key is locked or waiting in line for it (which needs deadlocks to
+// be broken, since keys are locked in random order).
+// Then, in the cluster, a transaction holds a hot key while its gateway is down, and a client retries writing the key
+// every tick until the transaction is pushed out of the way; the time the key was contended is reported.
+void BenchmarkLockTable() {
+    const int threads = 16;
+    const int transactions_per_thread = 50;
+    const int keys = 32;
+    const auto evaluation_time = chrono::microseconds(200);
+    // Retrying through the client costs a round trip to it.
+    const auto client_round_trip = chrono::microseconds(1000);
+    cout << "Lock table microbenchmark (" << threads << " clients, " << transactions_per_thread
+         << " transactions each locking 2 of " << keys << " keys)" << endl;
+
+    for (bool wait_queues : {false, true}) {
+        auto start = chrono::steady_clock::now();
+        LockTable lock_table{[start]() {
+            return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        }};
+        atomic<long long> retries = 0;
+        vector<thread> workers;
+        for (int i = 0; i < threads; i++) {
+            workers.emplace_back([&, i]() {
+                mt19937 random{(unsigned) i};
+                for (int j = 0; j < transactions_per_thread; j++) {
+                    long long transaction_id = MakeTransactionId(i + 1, j + 1);
+                    // Transactions are as old as the time at which they started, which their retries keep.
+                    auto timestamp = (Timestamp) chrono::duration_cast<chrono::microseconds>(
+                            chrono::steady_clock::now() - start).count();
+                    int first = (int) (random() % keys);
+                    int second = (first + 1 + (int) (random() % (keys - 1))) % keys;
+                    // Transactions that run are never pushed out of the way, so waiters block until they finish.
+                    auto push = [](long long) { return false; };
+                    // Each key is written once it is locked, so a retry loses the work done on the first one.
+                    auto write = [&](int key) {
+                        if (lock_table.Wait(key, transaction_id, timestamp, push, wait_queues, true) < 0) return false;
+                        this_thread::sleep_for(evaluation_time);
+                        return true;
+                    };
+                    while (true) {
+                        bool locked = write(first) && write(second);
+                        lock_table.ReleaseLocks(transaction_id);
+                        if (locked) break;
+                        retries++;
+                        if (!wait_queues) this_thread::sleep_for(client_round_trip);
+                    }
+                }
+            });
+        }
+        for (auto &worker : workers) worker.join();
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        auto contention = lock_table.Contention();
+        auto hottest = max_element(contention.begin(), contention.end(),
+                                   [](const auto &a, const auto &b) { return a.second < b.second; });
+        cout << "  " << (wait_queues ? "wait queues:" : "spin-retry: ") << " "
+             << threads * transactions_per_thread / seconds << " transactions per second, " << retries
+             << " retries, " << lock_table.Deadlocks() << " deadlocks broken, hottest key " << hottest->first
+             << " contended for " << hottest->second << " ms" << endl;
+    }
+
+    int ticks = 0;
+    map<int, double> contention;
+    {
+        QuietOutput quiet;
+        DistributionLayer distribution_layer{5, 3, MakeTransactionSettings(false, false, true)};
+        for (int key = 0; key <= MAX_KEY; key++) distribution_layer.Insert(key, key);
+        distribution_layer.SetGateway(0);
+        auto transaction_id = distribution_layer.BeginTransaction();
+        distribution_layer.Update(5, 1000, transaction_id);
+        distribution_layer.StopNode(0);
+        distribution_layer.SetGateway(1);
+        while (ticks < 50 && distribution_layer.Update(5, ticks) < 0) {
+            distribution_layer.Tick();
+            ticks++;
+        }
+        contention = distribution_layer.Contention();
+    }
+    cout << "  cluster, key locked by a crashed gateway: written by a retrying client after " << ticks
+         << " ticks, contended for " << contention[5] << " ms" << endl;
+}
+
+void RunBenchmarks() {
+    BenchmarkSkewedWorkload();
+    BenchmarkMembershipChanges();
+    BenchmarkLeaseholderLeaderColocation();
+    BenchmarkLeaseTransferUnderLoad();
+    BenchmarkFollowTheWorkload();
+    BenchmarkRegionalPlacement();
+    BenchmarkZoneConfigs();
+    BenchmarkNonVotingReplicas();
+    BenchmarkFollowerReads();
+    BenchmarkHybridLogicalClock();
+    BenchmarkTimestampCache();
+    BenchmarkLatchManager();
+    BenchmarkTransactions();
+    BenchmarkOnePhaseCommit();
+    BenchmarkParallelCommits();
+    BenchmarkLockTable();
+    BenchmarkWritePipelining();
+    BenchmarkReadOnlyTransactions();
+    BenchmarkTimeTravelScans();
+    BenchmarkReadModifyWrite();
+}
+
+
+int main(int argc, char *argv[]) {
+    if (argc > 1 && string(argv[1]) == "bench") {
+        RunBenchmarks();
+        return 0;
+    }
+
+    // For demonstration purposes, the leaseholder and the leader of every Range are on different nodes.
+    ClusterSettings settings;
+    settings.colocate_leaseholder_and_leader = false;
+    DistributionLayer distribution_layer{5, 3, settings};
 
     distribution_layer.Insert(1, 223);
     distribution_layer.Insert(10, 65422);
@@ -297,5 +2343,55 @@ int main() {
     distribution_layer.Remove(49);
     distribution_layer.PrintNodes();
 
+    // Hammer a small part of the key space so that its Range gets split by load.
+    for (int i = 0; i < 2 * OPERATIONS_PER_TICK; i++) {
+        distribution_layer.Insert(50 + i % 5, i);
+    }
+    distribution_layer.PrintNodes();
+
+    // Stop the leaseholder of the first Range. Requests for its Ranges fail until its liveness record expires and
+    // other replicas acquire its leases.
+    int stopped_node_id = distribution_layer.GetRangeDescriptors().begin()->second.leaseholder_id;
+    distribution_layer.StopNode(stopped_node_id);
+    for (int i = 0; i < 4 * OPERATIONS_PER_TICK; i++) {
+        distribution_layer.Get(i);
+    }
+    distribution_layer.RestartNode(stopped_node_id);
+
+    // Keep the keys in [60, 69] in five replicas.
+    ZoneConfig hot_table;
+    hot_table.num_replicas = 5;
+    distribution_layer.SetZoneConfig(60, 69, hot_table);
+    distribution_layer.Tick();
+    distribution_layer.Tick();
+
+    // Prefer the lease of the first Range to be on the replica that is neither its leader nor its leaseholder. It is
+    // moved there on the next tick.
+    auto first_range = distribution_layer.GetRangeDescriptors().begin()->second;
+    for (auto replica_id : first_range.replicas_id) {
+        if (replica_id == first_range.leader_id || replica_id == first_range.leaseholder_id) continue;
+        distribution_layer.SetLeasePreferences(first_range.id, {replica_id});
+    }
+    distribution_layer.Tick();
+
+    // Move 100 from key 50 to key 70 atomically, even though they are in different Ranges. The transaction is retried
+    // if its writes were pushed above the timestamp at which it read.
+    for (int attempt = 0; attempt < 3; attempt++) {
+        auto transaction_id = distribution_layer.BeginTransaction();
+        int from = distribution_layer.Get(50, 0, transaction_id);
+        int to = distribution_layer.Get(70, 0, transaction_id);
+        if (from < 100 || to < 0 || distribution_layer.Update(50, from - 100, transaction_id) < 0
+            || distribution_layer.Update(70, to + 100, transaction_id) < 0) {
+            distribution_layer.AbortTransaction(transaction_id);
+            break;
+        }
+        if (distribution_layer.CommitTransaction(transaction_id) >= 0) break;
+    }
+
+    print_range_descriptor(distribution_layer.GetRangeDescriptors().begin()->second);
+    cout << distribution_layer.LivenessHeartbeats() << " liveness heartbeats kept "
+         << distribution_layer.GetRangeDescriptors().size() << " range leases alive" << endl;
+    distribution_layer.PrintNodes();
+
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,79 @@
+#include <bits/stdc++.h>
+#include "clock.h"
+
+using namespace std;
+
+#ifndef CRDB_REPLICATION_LAYER_HLC_H
+#define CRDB_REPLICATION_LAYER_HLC_H
+
+// Hybrid logical clock timestamp, packed into 64 bits: the upper 48 bits hold the physical time in milliseconds and
+// the lower 16 bits a logical counter that orders events happening at the same physical time. Packed timestamps
+// compare like (physical, logical) pairs, and 0 means no timestamp.
+typedef uint64_t Timestamp;
+
+const int HLC_LOGICAL_BITS = 16;
+
+Timestamp MakeTimestamp(long long wall_time, long long logical = 0) {
+    return ((Timestamp) wall_time << HLC_LOGICAL_BITS) | (Timestamp) logical;
+}
+
+long long WallTime(Timestamp timestamp) {
+    return (long long) (timestamp >> HLC_LOGICAL_BITS);
+}
+
+long long Logical(Timestamp timestamp) {
+    return (long long) (timestamp & ((1 << HLC_LOGICAL_BITS) - 1));
+}
+
+// Timestamp at the start of the given tick of the simulated clock.
+Timestamp TickTimestamp(long long tick) {
+    return MakeTimestamp((long long) ((double) tick * TICK_DURATION_MS));
+}
+
+string ToString(Timestamp timestamp) {
+    return to_string(WallTime(timestamp)) + "," + to_string(Logical(timestamp));
+}
+
+// Hybrid logical clock of a node. Timestamps handed out by Now() are strictly increasing, never behind the physical
+// clock, and never behind any timestamp received through Update(), so they respect causality across nodes. The whole
+// state fits in a single atomic word and is only changed with compare-and-swap, so concurrent callers never block each
+// other. A logical counter that overflows carries into the physical time, which keeps timestamps increasing.
+class HybridLogicalClock {
+    SimulatedClock *clock_;
+    atomic<Timestamp> state_{0};
+
+    // Moves the clock past both its current state and the given timestamp, and returns the new state.
+    Timestamp Advance(Timestamp timestamp) {
+        Timestamp physical = TickTimestamp(clock_->Now());
+        Timestamp current = state_.load(memory_order_relaxed);
+        Timestamp next;
+        do {
+            Timestamp latest = max(current, timestamp);
+            // A physical time ahead of every timestamp seen so far starts a new logical counter, otherwise the counter
+            // of the latest one is incremented.
+            next = WallTime(physical) > WallTime(latest) ? physical : latest + 1;
+        } while (!state_.compare_exchange_weak(current, next, memory_order_acq_rel, memory_order_relaxed));
+        return next;
+    }
+
+public:
+    explicit HybridLogicalClock(SimulatedClock *clock) : clock_{clock} {
+    }
+
+    // Timestamp for a new event on this node, e.g. a command being sent.
+    Timestamp Now() {
+        return Advance(0);
+    }
+
+    // Called whenever a message carrying a timestamp is received.
+    Timestamp Update(Timestamp timestamp) {
+        return Advance(timestamp);
+    }
+
+    // Latest timestamp handed out, without advancing the clock.
+    [[nodiscard]] Timestamp Last() const {
+        return state_.load(memory_order_acquire);
+    }
+};
+
+#endif //CRDB_REPLICATION_LAYER_HLC_H
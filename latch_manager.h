@@ -0,0 +1,94 @@
+#include <bits/stdc++.h>
+
+using namespace std;
+
+#ifndef CRDB_REPLICATION_LAYER_LATCH_MANAGER_H
+#define CRDB_REPLICATION_LAYER_LATCH_MANAGER_H
+
+enum LatchAccess {
+    READ_LATCH,
+    WRITE_LATCH
+};
+
+// A latch over the keys in [start, end]. Read latches are compatible with each other, while a write latch conflicts
+// with any other latch over an overlapping span.
+struct Latch {
+    int start;
+    int end;
+    LatchAccess access;
+};
+
+bool Conflicts(const Latch &a, const Latch &b) {
+    bool overlap = a.start <= b.end && b.start <= a.end;
+    return overlap && (a.access == WRITE_LATCH || b.access == WRITE_LATCH);
+}
+
+// Serializes the commands evaluated by a leaseholder only when they touch overlapping keys, so that commands on
+// independent keys can be evaluated concurrently. Every command is given a sequence number when it asks for its latch,
+// and then waits until every conflicting latch with a lower sequence number has been released, which makes the latches
+// over each key be granted in arrival order (a wait queue per key).
+class LatchManager {
+    mutex mutex_;
+    condition_variable released_;
+    // Latches that have been acquired or are waiting to be, by (start key, sequence number).
+    map<pair<int, long long>, Latch> latches_;
+    long long next_sequence_ = 0;
+    long long waits_ = 0;
+
+    // Returns true if a latch with a lower sequence number conflicts with the given one.
+    bool MustWait(const Latch &latch, long long sequence) {
+        // Only latches starting at or before the end of this one can overlap it.
+        auto last = latches_.upper_bound({latch.end, LLONG_MAX});
+        for (auto it = latches_.begin(); it != last; it++) {
+            if (it->first.second < sequence && Conflicts(it->second, latch)) return true;
+        }
+        return false;
+    }
+
+public:
+    // Blocks until the latch is acquired, and returns the key needed to release it.
+    pair<int, long long> Acquire(const Latch &latch) {
+        unique_lock<mutex> lock{mutex_};
+        pair<int, long long> key{latch.start, next_sequence_++};
+        latches_[key] = latch;
+        if (MustWait(latch, key.second)) {
+            waits_++;
+            released_.wait(lock, [&]() { return !MustWait(latch, key.second); });
+        }
+        return key;
+    }
+
+    void Release(const pair<int, long long> &key) {
+        {
+            lock_guard<mutex> lock{mutex_};
+            latches_.erase(key);
+        }
+        released_.notify_all();
+    }
+
+    // Number of latches that had to wait for a conflicting one.
+    long long Waits() {
+        lock_guard<mutex> lock{mutex_};
+        return waits_;
+    }
+};
+
+// Holds a latch for as long as it is in scope.
+class LatchGuard {
+    LatchManager *latch_manager_;
+    pair<int, long long> key_;
+
+public:
+    LatchGuard(LatchManager *latch_manager, const Latch &latch)
+            : latch_manager_{latch_manager}, key_{latch_manager->Acquire(latch)} {
+    }
+
+    LatchGuard(const LatchGuard &) = delete;
+    LatchGuard &operator=(const LatchGuard &) = delete;
+
+    ~LatchGuard() {
+        latch_manager_->Release(key_);
+    }
+};
+
+#endif //CRDB_REPLICATION_LAYER_LATCH_MANAGER_H
@@ -0,0 +1,68 @@
+#include <bits/stdc++.h>
+#include "clock.h"
+
+using namespace std;
+
+#ifndef CRDB_REPLICATION_LAYER_LIVENESS_H
+#define CRDB_REPLICATION_LAYER_LIVENESS_H
+
+// Number of ticks a node is considered live after its last heartbeat.
+const long long LIVENESS_TTL = 2;
+
+struct LivenessRecord {
+    // Incremented by other nodes once this one stops heartbeating, which invalidates all of its leases at once.
+    int epoch = 1;
+    // The node is live until this moment.
+    long long expiration = 0;
+};
+
+// Liveness records of every node. In practice these are stored in a system Range, here every node holds a pointer to
+// the same object.
+//
+// Range leases are tied to the epoch of the leaseholder's liveness record instead of having their own expiration, so a
+// single heartbeat per node keeps all of its leases alive. When a node stops heartbeating, its epoch is incremented
+// and every lease it held becomes invalid, which lets other replicas acquire them.
+class NodeLiveness {
+    SimulatedClock *clock_;
+    map<int, LivenessRecord> records_;
+    long long heartbeats_ = 0;
+
+public:
+    explicit NodeLiveness(SimulatedClock *clock) : clock_{clock} {
+    }
+
+    // Extends the liveness of the node for LIVENESS_TTL ticks.
+    void Heartbeat(int node_id) {
+        records_[node_id].expiration = clock_->Now() + LIVENESS_TTL;
+        heartbeats_++;
+    }
+
+    [[nodiscard]] bool IsLive(int node_id) const {
+        auto it = records_.find(node_id);
+        return it != records_.end() && it->second.expiration > clock_->Now();
+    }
+
+    [[nodiscard]] int Epoch(int node_id) const {
+        auto it = records_.find(node_id);
+        return it == records_.end() ? 0 : it->second.epoch;
+    }
+
+    // Invalidates every lease held by a node that is no longer live. Returns false if the node is still live, in which
+    // case its epoch cannot be incremented.
+    bool IncrementEpoch(int node_id) {
+        if (IsLive(node_id)) return false;
+        records_[node_id].epoch++;
+        return true;
+    }
+
+    // A lease is valid as long as its leaseholder is live and still in the epoch in which the lease was acquired.
+    [[nodiscard]] bool IsLeaseValid(int leaseholder_id, int lease_epoch) const {
+        return IsLive(leaseholder_id) && Epoch(leaseholder_id) == lease_epoch;
+    }
+
+    [[nodiscard]] long long Heartbeats() const {
+        return heartbeats_;
+    }
+};
+
+#endif //CRDB_REPLICATION_LAYER_LIVENESS_H
@@ -0,0 +1,27 @@
+#include <bits/stdc++.h>
+
+using namespace std;
+
+#ifndef CRDB_REPLICATION_LAYER_LOCALITY_H
+#define CRDB_REPLICATION_LAYER_LOCALITY_H
+
+// Where a node is located. Nodes in different regions are far apart (see INTER_REGION_LATENCY), while zones within a
+// region are close to each other but fail independently.
+struct Locality {
+    string region = "default";
+    string zone;
+};
+
+// How independently two nodes fail: 1 if they are in different regions, 0.5 if they are in different zones of the same
+// region, and 0 otherwise.
+double LocalityDiversity(const Locality &a, const Locality &b) {
+    if (a.region != b.region) return 1;
+    if (a.zone != b.zone) return 0.5;
+    return 0;
+}
+
+string ToString(const Locality &locality) {
+    return "region=" + locality.region + ",zone=" + locality.zone;
+}
+
+#endif //CRDB_REPLICATION_LAYER_LOCALITY_H
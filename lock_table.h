@@ -0,0 +1,195 @@
+#include <bits/stdc++.h>
+#include "hlc.h"
+
+using namespace std;
+
+#ifndef CRDB_REPLICATION_LAYER_LOCK_TABLE_H
+#define CRDB_REPLICATION_LAYER_LOCK_TABLE_H
+
+// Locks held by transactions on the keys of a leaseholder (e.g. because they wrote an intent there), and the requests
+// waiting for them. Requests wait for each lock in arrival order, and only the first one (the distinguished waiter)
+// pushes the transaction holding it, while the rest wait behind it without pushing too. Waiting transactions form a
+// waits-for graph, and whenever a new wait closes a cycle, the youngest transaction in it (the one with the highest
+// timestamp, as when pushing) is chosen to break the deadlock. The table also keeps how long each key was locked while
+// some request wanted it, so that hot keys can be found.
+class LockTable {
+    struct Waiter {
+        // Identifies the request, since requests that are not part of a transaction all have transaction id 0.
+        long long token;
+        long long transaction_id;
+    };
+
+    struct Lock {
+        // Transaction holding the lock, or 0 if it's free.
+        long long holder = 0;
+        // Requests waiting for the lock, in arrival order.
+        deque<Waiter> waiters;
+        // Time at which some request started waiting for the current holder, or -1 if none has.
+        double contended_since = -1;
+    };
+
+    std::mutex mutex_;
+    condition_variable changed_;
+    map<int, Lock> locks_;
+    long long next_token_ = 1;
+    // Key that each waiting transaction waits for, from which the edges of the waits-for graph are derived.
+    map<long long, int> waiting_for_;
+    // Timestamp of each waiting transaction, by which the victim of a deadlock is chosen.
+    map<long long, Timestamp> timestamps_;
+    // Transactions chosen to break a deadlock, which must stop waiting and abort.
+    set<long long> victims_;
+    // Current time in milliseconds.
+    function<double()> now_;
+    // Time each key was locked while some request wanted it, in milliseconds.
+    map<int, double> contention_;
+    long long deadlocks_ = 0;
+
+    void Release(int key, Lock &lock) {
+        if (lock.contended_since >= 0) contention_[key] += now_() - lock.contended_since;
+        lock.contended_since = -1;
+        lock.holder = 0;
+        if (lock.waiters.empty()) locks_.erase(key);
+        changed_.notify_all();
+    }
+
+    void StopWaiting(int key, long long token, long long transaction_id) {
+        auto &lock = locks_[key];
+        lock.waiters.erase(find_if(lock.waiters.begin(), lock.waiters.end(),
+                                   [&](const Waiter &waiter) { return waiter.token == token; }));
+        waiting_for_.erase(transaction_id);
+        timestamps_.erase(transaction_id);
+        if (lock.holder == 0 && lock.waiters.empty()) locks_.erase(key);
+        changed_.notify_all();
+    }
+
+    // Transaction that a waiting transaction waits for: the holder of the lock, or the first waiter if the lock was
+    // just released. Returns 0 if there is none.
+    long long Blocker(long long transaction_id) {
+        auto it = waiting_for_.find(transaction_id);
+        if (it == waiting_for_.end()) return 0;
+        const auto &lock = locks_[it->second];
+        long long blocker = lock.holder != 0 ? lock.holder : lock.waiters.front().transaction_id;
+        return blocker == transaction_id ? 0 : blocker;
+    }
+
+    // Follows the waits-for graph from the given transaction, and picks a victim if it leads back to it.
+    void DetectDeadlock(long long transaction_id) {
+        vector<long long> cycle{transaction_id};
+        for (long long blocker = Blocker(transaction_id); blocker != 0; blocker = Blocker(blocker)) {
+            if (blocker == transaction_id) {
+                // The deadlock may already be being broken.
+                if (any_of(cycle.begin(), cycle.end(), [&](long long id) { return victims_.contains(id); })) return;
+                deadlocks_++;
+                // Every transaction in the cycle is waiting, so all of their timestamps are known.
+                victims_.insert(*max_element(cycle.begin(), cycle.end(), [&](long long a, long long b) {
+                    return pair{timestamps_[a], a} < pair{timestamps_[b], b};
+                }));
+                changed_.notify_all();
+                return;
+            }
+            if (find(cycle.begin(), cycle.end(), blocker) != cycle.end()) return;
+            cycle.push_back(blocker);
+        }
+    }
+
+public:
+    explicit LockTable(function<double()> now) : now_{std::move(now)} {
+    }
+
+    // Records that the transaction holds the lock on the key, e.g. because an intent of it was found there.
+    void AddLock(int key, long long holder) {
+        lock_guard<std::mutex> lock{mutex_};
+        auto &entry = locks_[key];
+        if (entry.holder == 0) entry.holder = holder;
+    }
+
+    // Releases the lock on the key if the transaction holds it, e.g. because its intent was resolved.
+    void ReleaseLock(int key, long long holder) {
+        lock_guard<std::mutex> lock{mutex_};
+        auto it = locks_.find(key);
+        if (it != locks_.end() && it->second.holder == holder) Release(key, it->second);
+    }
+
+    void ReleaseLocks(long long holder) {
+        lock_guard<std::mutex> lock{mutex_};
+        vector<int> keys;
+        for (const auto &[key, entry] : locks_) {
+            if (entry.holder == holder) keys.push_back(key);
+        }
+        for (auto key : keys) Release(key, locks_[key]);
+    }
+
+    // Waits in line until the lock on the key is free or held by the transaction itself (0 if the request is not part
+    // of a transaction), and takes it if acquire is set. The timestamp of the transaction decides whether it is the
+    // victim when its wait closes a deadlock. When the request reaches the front of the line, it pushes
+    // the holder with push, which returns true if the request can go ahead anyway (e.g. because the holder was
+    // aborted, or pushed above the timestamp of a read). If block is false, the request gives up instead of waiting
+    // once that push fails. Returns 0 if the request can go ahead, and -1 if it gave up or was chosen to break a
+    // deadlock, in which case its transaction must abort.
+    int Wait(int key, long long transaction_id, Timestamp timestamp, const function<bool(long long)> &push, bool block,
+             bool acquire = false) {
+        unique_lock<std::mutex> lock{mutex_};
+        auto &entry = locks_[key];
+        long long token = next_token_++;
+        entry.waiters.push_back({token, transaction_id});
+        long long pushed_holder = 0;
+        while (true) {
+            if (victims_.contains(transaction_id)) {
+                victims_.erase(transaction_id);
+                StopWaiting(key, token, transaction_id);
+                return -1;
+            }
+            bool first = entry.waiters.front().token == token;
+            if (first && (entry.holder == 0 || entry.holder == transaction_id)) {
+                entry.waiters.pop_front();
+                waiting_for_.erase(transaction_id);
+                timestamps_.erase(transaction_id);
+                if (acquire) entry.holder = transaction_id;
+                else if (entry.holder == 0 && entry.waiters.empty()) locks_.erase(key);
+                changed_.notify_all();
+                return 0;
+            }
+
+            if (entry.holder != 0 && entry.contended_since < 0) entry.contended_since = now_();
+            if (transaction_id != 0) {
+                waiting_for_[transaction_id] = key;
+                timestamps_[transaction_id] = timestamp;
+                DetectDeadlock(transaction_id);
+                if (victims_.contains(transaction_id)) continue;
+            }
+            if (first && entry.holder != pushed_holder) {
+                pushed_holder = entry.holder;
+                lock.unlock();
+                bool proceed = push(pushed_holder);
+                lock.lock();
+                if (proceed) {
+                    StopWaiting(key, token, transaction_id);
+                    return 0;
+                }
+                continue;
+            }
+            if (!block) {
+                StopWaiting(key, token, transaction_id);
+                return -1;
+            }
+            changed_.wait(lock);
+        }
+    }
+
+    // Time each key was locked while some request wanted it (including the locks still contended), in milliseconds.
+    map<int, double> Contention() {
+        lock_guard<std::mutex> lock{mutex_};
+        auto contention = contention_;
+        for (const auto &[key, entry] : locks_) {
+            if (entry.contended_since >= 0) contention[key] += now_() - entry.contended_since;
+        }
+        return contention;
+    }
+
+    long long Deadlocks() {
+        lock_guard<std::mutex> lock{mutex_};
+        return deadlocks_;
+    }
+};
+
+#endif //CRDB_REPLICATION_LAYER_LOCK_TABLE_H
@@ -0,0 +1,111 @@
+#include <bits/stdc++.h>
+#include "hlc.h"
+
+using namespace std;
+
+#ifndef CRDB_REPLICATION_LAYER_MVCC_STORE_H
+#define CRDB_REPLICATION_LAYER_MVCC_STORE_H
+
+// Latest possible timestamp, for reading the latest version of a key.
+const Timestamp MAX_TIMESTAMP = numeric_limits<Timestamp>::max();
+
+// Version of a key written at some timestamp. Deleting a key writes a tombstone.
+struct Version {
+    int value;
+    bool deleted = false;
+};
+
+// Versions of each key, newest first.
+typedef map<int, map<Timestamp, Version, greater<>>> VersionMap;
+
+// Multi-version key-value store (our stand-in for RocksDB): writes add a new version of their key at their timestamp
+// instead of overwriting it, so that the store can be read as of any timestamp whose versions haven't been garbage
+// collected yet.
+class MVCCStore {
+    VersionMap versions_;
+
+    // Version of the key visible at the timestamp, or nullptr if there is none.
+    [[nodiscard]] const Version *Find(int key, Timestamp timestamp) const {
+        auto it = versions_.find(key);
+        if (it == versions_.end()) return nullptr;
+        auto version = it->second.lower_bound(timestamp);
+        return version == it->second.end() ? nullptr : &version->second;
+    }
+
+public:
+    // Value of the key as of the timestamp (the latest one by default), or nullopt if it didn't exist then.
+    [[nodiscard]] optional<int> Get(int key, Timestamp timestamp = MAX_TIMESTAMP) const {
+        auto version = Find(key, timestamp);
+        if (version == nullptr || version->deleted) return nullopt;
+        return version->value;
+    }
+
+    [[nodiscard]] bool Contains(int key) const {
+        return Get(key).has_value();
+    }
+
+    // Timestamp of the latest version of the key, or 0 if it has none.
+    [[nodiscard]] Timestamp LatestTimestamp(int key) const {
+        auto it = versions_.find(key);
+        return it == versions_.end() || it->second.empty() ? 0 : it->second.begin()->first;
+    }
+
+    void Put(int key, Timestamp timestamp, int value) {
+        versions_[key][timestamp] = {value};
+    }
+
+    void Delete(int key, Timestamp timestamp) {
+        versions_[key][timestamp] = {0, true};
+    }
+
+    // Keys in [start, end] that existed as of the timestamp, with their values then.
+    [[nodiscard]] map<int, int> Scan(int start, int end, Timestamp timestamp = MAX_TIMESTAMP) const {
+        map<int, int> rows;
+        for (auto it = versions_.lower_bound(start); it != versions_.end() && it->first <= end; it++) {
+            auto value = Get(it->first, timestamp);
+            if (value.has_value()) rows[it->first] = *value;
+        }
+        return rows;
+    }
+
+    // Number of keys in [start, end] that currently exist.
+    [[nodiscard]] int Count(int start, int end) const {
+        return (int) Scan(start, end).size();
+    }
+
+    // Removes the versions of the keys in [start, end] that no read at or above the threshold can see: every version
+    // older than the one visible at the threshold, and that one too if it is a tombstone. Returns how many were
+    // removed.
+    int GarbageCollect(int start, int end, Timestamp threshold) {
+        int removed = 0;
+        for (auto it = versions_.lower_bound(start); it != versions_.end() && it->first <= end;) {
+            auto &versions = it->second;
+            auto visible = versions.lower_bound(threshold);
+            if (visible != versions.end()) {
+                auto first_removed = visible->second.deleted ? visible : next(visible);
+                removed += (int) distance(first_removed, versions.end());
+                versions.erase(first_removed, versions.end());
+            }
+            if (versions.empty()) it = versions_.erase(it);
+            else it++;
+        }
+        return removed;
+    }
+
+    // Every version of the keys in [start, end].
+    [[nodiscard]] VersionMap Versions(int start, int end) const {
+        return {versions_.lower_bound(start), versions_.upper_bound(end)};
+    }
+
+    void Ingest(const VersionMap &versions) {
+        for (const auto &[key, key_versions] : versions) {
+            versions_[key].insert(key_versions.begin(), key_versions.end());
+        }
+    }
+
+    void Clear(int start, int end) {
+        versions_.erase(versions_.lower_bound(start), versions_.upper_bound(end));
+    }
+};
+
+#endif //CRDB_REPLICATION_LAYER_MVCC_STORE_H
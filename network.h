@@ -0,0 +1,110 @@
+#include <bits/stdc++.h>
+#include "locality.h"
+
+using namespace std;
+
+#ifndef CRDB_REPLICATION_LAYER_NETWORK_H
+#define CRDB_REPLICATION_LAYER_NETWORK_H
+
+// One-way latency of a message between two different nodes in the same region, in milliseconds.
+const double NODE_TO_NODE_LATENCY = 1.0;
+// One-way latency of a message between two nodes in different regions, in milliseconds.
+const double INTER_REGION_LATENCY = 40.0;
+
+// Since nodes are plain objects calling each other's methods, this class keeps track of what it would have cost to send
+// those calls through the network: the number of hops taken by requests while being forwarded between nodes, and the
+// latency they accumulated (forwarding round trips plus replication).
+class SimulatedNetwork {
+    long long hops_ = 0;
+    double latency_ = 0;
+    map<int, Locality> localities_;
+    // Messages sent after the client has already been answered (e.g. to resolve the intents of a committed
+    // transaction) don't add to the hops nor the latency of any request.
+    bool background_ = false;
+    // Latency before the requests being sent in parallel, and that of the slowest of them so far.
+    double parallel_start_ = 0;
+    double slowest_branch_ = 0;
+
+public:
+    void SetLocality(int node_id, const Locality &locality) {
+        localities_[node_id] = locality;
+    }
+
+    [[nodiscard]] Locality GetLocality(int node_id) const {
+        auto it = localities_.find(node_id);
+        return it == localities_.end() ? Locality{} : it->second;
+    }
+
+    [[nodiscard]] double Latency(int from_id, int to_id) const {
+        if (from_id == to_id) return 0;
+        if (GetLocality(from_id).region != GetLocality(to_id).region) return INTER_REGION_LATENCY;
+        return NODE_TO_NODE_LATENCY;
+    }
+
+    // Records a request forwarded from one node to another, and its response.
+    void RecordRoundTrip(int from_id, int to_id) {
+        if (from_id == to_id || background_) return;
+        hops_++;
+        latency_ += 2 * Latency(from_id, to_id);
+    }
+
+    // Records the replication of a command from the leader to the rest of the replicas. Even though the simulation
+    // waits for every live replica, a real leader can commit as soon as a majority (itself included) has the command in
+    // its log, so replication costs a round trip to the closest follower that completes that majority.
+    void RecordReplication(int leader_id, const set<int> &replicas_id) {
+        if (background_) return;
+        vector<double> latencies;
+        for (auto replica_id : replicas_id) {
+            if (replica_id != leader_id) latencies.push_back(Latency(leader_id, replica_id));
+        }
+        int followers_needed = (int) replicas_id.size() / 2;
+        if (followers_needed == 0 || latencies.empty()) return;
+        sort(latencies.begin(), latencies.end());
+        latency_ += 2 * latencies[min(followers_needed, (int) latencies.size()) - 1];
+    }
+
+    // Records time spent by a request waiting at a node, e.g. for a lease to become usable.
+    void RecordWait(double milliseconds) {
+        if (!background_) latency_ += milliseconds;
+    }
+
+    void SetBackground(bool background) {
+        background_ = background;
+    }
+
+    [[nodiscard]] bool Background() const {
+        return background_;
+    }
+
+    // Requests sent between BeginParallel and EndParallel are sent at the same time, in branches separated by calls to
+    // NextBranch, so only the latency of the slowest branch is added.
+    void BeginParallel() {
+        parallel_start_ = latency_;
+        slowest_branch_ = 0;
+    }
+
+    void NextBranch() {
+        slowest_branch_ = max(slowest_branch_, latency_ - parallel_start_);
+        latency_ = parallel_start_;
+    }
+
+    void EndParallel() {
+        NextBranch();
+        latency_ = parallel_start_ + slowest_branch_;
+    }
+
+    [[nodiscard]] long long Hops() const {
+        return hops_;
+    }
+
+    [[nodiscard]] double TotalLatency() const {
+        return latency_;
+    }
+
+    void Reset() {
+        hops_ = 0;
+        latency_ = 0;
+    }
+};
+
+#endif //CRDB_REPLICATION_LAYER_NETWORK_H
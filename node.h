@@ -4,19 +4,58 @@
 
 #include <bits/stdc++.h>
 #include "command.h"
+#include "range_load.h"
+#include "network.h"
+#include "liveness.h"
+#include "hlc.h"
+#include "timestamp_cache.h"
+#include "latch_manager.h"
+#include "lock_table.h"
+#include "mvcc_store.h"
+#include "transaction.h"
 
 using namespace std;
 
 #ifndef CRDB_REPLICATION_LAYER_NODE_H
 #define CRDB_REPLICATION_LAYER_NODE_H
 
+// Leaseholders close timestamps this many ticks in the past, which followers can then serve reads at.
+const long long CLOSED_TIMESTAMP_TARGET = 2;
+
+// Most recent timestamp that every replica is guaranteed to have closed at the given tick, since closed timestamps are
+// published once per tick.
+Timestamp FollowerReadTimestamp(long long now) {
+    return TickTimestamp(max(0LL, now - CLOSED_TIMESTAMP_TARGET - 1));
+}
+
 struct RangeDescriptor {
     int id;
     int start;
     int end;
     int leader_id;
     int leaseholder_id;
+    // Epoch of the leaseholder's liveness record in which the lease was acquired.
+    int lease_epoch = 1;
+    // Tick from which the leaseholder can start serving requests with its lease.
+    long long lease_start = 0;
+    // Nodes on which the lease should be placed, in order of preference. Empty if any replica can hold it.
+    vector<int> lease_preferences;
+    // Voting replicas, which form the Raft group of the Range. The leader and the leaseholder are always among them.
     std::set<int> replicas_id;
+    // Non-voting replicas receive every committed command, but don't count towards quorum, so they can be placed far
+    // away from the voters without slowing down writes.
+    std::set<int> non_voters_id;
+    // Versions that were not visible at this timestamp may have been garbage collected, so reads can't go below it.
+    Timestamp gc_threshold = 0;
+};
+
+// Copy of the data inside a Range, used to bring a new replica of the Range up to date.
+struct Snapshot {
+    // Every version of the keys inside the Range.
+    VersionMap versions;
+    map<int, Intent> intents;
+    // Records of the transactions anchored inside the Range.
+    map<long long, TransactionRecord> transaction_records;
 };
 
 void print_range_descriptor(const RangeDescriptor &descriptor) {
@@ -25,10 +64,22 @@ void print_range_descriptor(const RangeDescriptor &descriptor) {
     cout << "start: " << descriptor.start << endl;
     cout << "end: " << descriptor.end << endl;
     cout << "leaseholder_id: " << descriptor.leaseholder_id << endl;
+    cout << "lease_epoch: " << descriptor.lease_epoch << endl;
+    cout << "lease_start: " << descriptor.lease_start << endl;
     cout << "leader_id: " << descriptor.leader_id << endl;
+    if (!descriptor.lease_preferences.empty()) {
+        cout << "lease_preferences: [ ";
+        for (auto id: descriptor.lease_preferences) cout << id << " ";
+        cout << "]" << endl;
+    }
     cout << "replicas_id: { ";
     for (auto id: descriptor.replicas_id) cout << id << " ";
     cout << "}" << endl;
+    if (!descriptor.non_voters_id.empty()) {
+        cout << "non_voters_id: { ";
+        for (auto id: descriptor.non_voters_id) cout << id << " ";
+        cout << "}" << endl;
+    }
 }
 
 
@@ -36,55 +87,247 @@ class Node {
     int id_;
     map<int, RangeDescriptor> interval_start_to_range_descriptor_;
     // Ordered underlying key-value store (simulating RocksDB)
-    map<int, int> key_value_store_;
+    MVCCStore key_value_store_;
+    // Intents written by transactions that have not been resolved yet, by key.
+    map<int, Intent> intents_;
+    // Records of the transactions anchored in the Ranges of which this node is a replica, by transaction id.
+    map<long long, TransactionRecord> transaction_records_;
+    // Transactions coordinated by this node that have not finished yet, by id.
+    map<long long, Transaction> transactions_;
+    long long next_transaction_sequence_ = 1;
+    // Simulates this node crashing in the middle of the next parallel commit it coordinates, right after writing the
+    // STAGING record and the intents of the transaction.
+    bool crash_during_commit_ = false;
     map<int, Node *> nodes_;
+    SimulatedNetwork *network_;
+    NodeLiveness *liveness_;
+    SimulatedClock *clock_;
+    HybridLogicalClock hlc_;
+    Locality locality_;
+    // Timestamps at which this node served reads as leaseholder (or that it received when it acquired a lease). No
+    // write may be applied at or below them.
+    TimestampCache timestamp_cache_;
+    // Latches over the keys of the commands that this node is evaluating as leaseholder, so that only commands on
+    // overlapping keys are serialized.
+    LatchManager latch_manager_;
+    // Latches over the transaction records anchored in those Ranges, which live apart from the value of their anchor
+    // key, so that a command holding the latch of a key can still push the transaction with an intent on it.
+    LatchManager record_latch_manager_;
+    // Locks of the transactions with intents in the Ranges leased by this node, and the commands waiting for them.
+    LockTable lock_table_{[this]() { return (double) clock_->Now() * TICK_DURATION_MS; }};
+    // Closed timestamp of each Range of which this node is a replica, indexed by Range id. The replica has applied all
+    // writes at or below it, so it can serve reads at those timestamps without going through the leaseholder.
+    map<int, Timestamp> closed_timestamp_;
+    // Reads served by this node as a follower.
+    long long follower_reads_ = 0;
+    // Index of the last command applied by this replica, for each Range.
+    map<int, long long> applied_index_;
+    // Index of the last command proposed by this node as leaseholder (or that it received when it acquired the lease),
+    // for each Range. The leaseholder can only serve reads from its own store once it has applied it.
+    map<int, long long> lease_applied_index_;
+    // A node that is not live (e.g. it crashed) doesn't heartbeat nor answer any message.
+    bool live_ = true;
     vector<Command> log_;
+    // Load of the Ranges for which this node is the leaseholder, indexed by Range id.
+    map<int, RangeLoad> range_load_;
 
-
-    int ApplyCreate(int key, int value) {
+    int ApplyCreate(int key, int value, Timestamp timestamp) {
         cout << "Applying command CREATE in node " << id_ << endl;
-        if (key_value_store_.contains(key)) {
+        if (key_value_store_.Contains(key)) {
             cout << "Key " + to_string(key) + " already exists in this node" << endl;
             return -1;
         }
-        key_value_store_[key] = value;
+        key_value_store_.Put(key, timestamp, value);
 
         return 0;
     }
 
-    int ApplyRead(int key) {
+    int ApplyRead(const Command &command) {
         cout << "Applying command READ in node " << id_ << endl;
-        if (!key_value_store_.contains(key)) {
+        int key = command.key;
+        auto intent = intents_.find(key);
+        if (intent != intents_.end()) {
+            // Transactions read their own writes, while other commands can only ignore intents written above the
+            // timestamp they read at.
+            if (intent->second.transaction_id == command.transaction_id) {
+                if (intent->second.type != DELETE) return intent->second.value;
+                cout << "Key " + to_string(key) + " was deleted by this transaction" << endl;
+                return -1;
+            }
+            if (intent->second.timestamp <= command.timestamp) {
+                cout << "Key " << key << " has an intent of transaction " << intent->second.transaction_id << endl;
+                return -1;
+            }
+        }
+        auto value = key_value_store_.Get(key, command.timestamp);
+        if (!value.has_value()) {
             cout << "Key " + to_string(key) + " does not exist in this node" << endl;
             return -1;
         }
-        return key_value_store_[key];
+        return *value;
     }
 
-    int ApplyUpdate(int key, int new_value) {
+    // Reads every key in [command.key, command.value] into rows, and returns how many there are.
+    int ApplyScan(const Command &command, map<int, int> *rows) const {
+        cout << "Applying command SCAN in node " << id_ << endl;
+        auto result = key_value_store_.Scan(command.key, command.value, command.timestamp);
+        for (auto it = intents_.lower_bound(command.key); it != intents_.end() && it->first <= command.value; it++) {
+            const auto &[key, intent] = *it;
+            if (intent.transaction_id == command.transaction_id) {
+                if (intent.type == DELETE) result.erase(key);
+                else result[key] = intent.value;
+            } else if (intent.timestamp <= command.timestamp) {
+                cout << "Key " << key << " has an intent of transaction " << intent.transaction_id << endl;
+                return -1;
+            }
+        }
+        if (rows != nullptr) rows->insert(result.begin(), result.end());
+        return (int) result.size();
+    }
+
+    int ApplyUpdate(int key, int new_value, Timestamp timestamp) {
         cout << "Applying command UPDATE in node " << id_ << endl;
-        if (!key_value_store_.contains(key)) {
+        if (!key_value_store_.Contains(key)) {
             cout << "Key " + to_string(key) + " does not exist in this node" << endl;
             return -1;
         }
 
-        key_value_store_[key] = new_value;
+        key_value_store_.Put(key, timestamp, new_value);
         return 0;
     }
 
-    int ApplyDelete(int key) {
+    int ApplyDelete(int key, Timestamp timestamp) {
         cout << "Applying command DELETE in node " << id_ << endl;
-        if (!key_value_store_.contains(key)) {
+        if (!key_value_store_.Contains(key)) {
             cout << "Key " + to_string(key) + " does not exist in this node" << endl;
             return -1;
         }
-        key_value_store_.erase(key);
+        key_value_store_.Delete(key, timestamp);
+        return 0;
+    }
+
+    // Checks whether a write of a transaction can leave its intent on the key, given the intents and values that this
+    // node has applied. Returns 0 if it can, and -1 otherwise.
+    [[nodiscard]] int EvaluateIntent(const Command &command) const {
+        auto intent = intents_.find(command.key);
+        if (intent != intents_.end() && intent->second.transaction_id != command.transaction_id) {
+            cout << "Key " << command.key << " has an intent of transaction " << intent->second.transaction_id << endl;
+            return -1;
+        }
+        // The transaction sees its own intent instead of the current value.
+        bool exists = intent != intents_.end() ? intent->second.type != DELETE : key_value_store_.Contains(command.key);
+        if (command.type == CREATE && exists) {
+            cout << "Key " + to_string(command.key) + " already exists in this node" << endl;
+            return -1;
+        }
+        if (command.type != CREATE && !exists) {
+            cout << "Key " + to_string(command.key) + " does not exist in this node" << endl;
+            return -1;
+        }
+        return 0;
+    }
+
+    int ApplyIntent(const Command &command) {
+        cout << "Applying intent of transaction " << command.transaction_id << " in node " << id_ << endl;
+        if (EvaluateIntent(command) < 0) return -1;
+        intents_[command.key] = {command.transaction_id, command.type, command.value, command.timestamp,
+                                 command.anchor_key};
+        return 0;
+    }
+
+    int ApplyEndTransaction(const Command &command) {
+        cout << "Applying command END_TRANSACTION in node " << id_ << endl;
+        auto record = transaction_records_.find(command.transaction_id);
+        bool finished = record != transaction_records_.end() && record->second.status != PENDING
+                        && record->second.status != STAGING;
+        if (finished && record->second.status != command.transaction_status) {
+            cout << "Transaction " << command.transaction_id << " is already " << ToString(record->second.status)
+                 << endl;
+            return -1;
+        }
+        // A PENDING record is only written by a reader pushing the transaction, which can then only commit above it.
+        bool pushed = record != transaction_records_.end() && record->second.status == PENDING
+                      && command.timestamp < record->second.timestamp;
+        if (pushed && command.transaction_status != ABORTED) {
+            cout << "Transaction " << command.transaction_id << " was pushed to "
+                 << ToString(record->second.timestamp) << endl;
+            return -1;
+        }
+        transaction_records_[command.transaction_id] = {command.transaction_id, command.transaction_status,
+                                                        command.key, command.timestamp, command.intent_keys};
+        return 0;
+    }
+
+    int ApplyResolveIntent(const Command &command) {
+        cout << "Applying command RESOLVE_INTENT in node " << id_ << endl;
+        auto intent = intents_.find(command.key);
+        // The intent may have already been resolved.
+        if (intent == intents_.end() || intent->second.transaction_id != command.transaction_id) return 0;
+        if (command.transaction_status == PENDING) {
+            intent->second.timestamp = max(intent->second.timestamp, command.timestamp);
+            return 0;
+        }
+        lock_table_.ReleaseLock(command.key, command.transaction_id);
+        // The value is written at the timestamp at which the transaction committed.
+        if (command.transaction_status == COMMITTED) {
+            if (intent->second.type == DELETE) key_value_store_.Delete(command.key, command.timestamp);
+            else key_value_store_.Put(command.key, command.timestamp, intent->second.value);
+        }
+        intents_.erase(intent);
+        return 0;
+    }
+
+    // Returns the status of the transaction after the push, which leaves it as it is if it already finished or is
+    // STAGING (since it may have committed already).
+    int ApplyPushTransaction(const Command &command) {
+        cout << "Applying command PUSH_TRANSACTION in node " << id_ << endl;
+        auto record = transaction_records_.find(command.transaction_id);
+        if (record == transaction_records_.end()) {
+            TransactionRecord pushed{command.transaction_id, PENDING, command.key, 0};
+            record = transaction_records_.emplace(command.transaction_id, pushed).first;
+        }
+        if (record->second.status != PENDING) return record->second.status;
+        record->second.status = command.transaction_status;
+        record->second.timestamp = max(record->second.timestamp, command.timestamp);
+        return record->second.status;
+    }
+
+    int ApplyOnePhaseCommit(const Command &command, const RangeDescriptor &range_descriptor) {
+        cout << "Applying command ONE_PHASE_COMMIT of transaction " << command.transaction_id << " in node " << id_
+             << endl;
+        // Every write is checked before applying any of them, so that either all of them are applied or none is.
+        map<int, bool> exists;
+        for (const auto &write : command.writes) {
+            if (write.key < range_descriptor.start || write.key > range_descriptor.end) {
+                cout << "Key " << write.key << " is not inside the range" << endl;
+                return -1;
+            }
+            if (intents_.contains(write.key)) {
+                cout << "Key " << write.key << " has an intent of transaction " << intents_[write.key].transaction_id
+                     << endl;
+                return -1;
+            }
+            bool key_exists = exists.contains(write.key) ? exists[write.key] : key_value_store_.Contains(write.key);
+            if (write.type == CREATE && key_exists) {
+                cout << "Key " + to_string(write.key) + " already exists in this node" << endl;
+                return -1;
+            }
+            if (write.type != CREATE && !key_exists) {
+                cout << "Key " + to_string(write.key) + " does not exist in this node" << endl;
+                return -1;
+            }
+            exists[write.key] = write.type != DELETE;
+        }
+        for (const auto &write : command.writes) {
+            if (write.type == DELETE) key_value_store_.Delete(write.key, command.timestamp);
+            else key_value_store_.Put(write.key, command.timestamp, write.value);
+        }
         return 0;
     }
 
     int ApplyCommand(const Command &command, const RangeDescriptor &range_descriptor) {
         // If it's a read we can just apply the command straight up.
-        if (command.type == READ) return ApplyRead(command.key);
+        if (command.type == READ) return ApplyRead(command);
 
         // Normally, we would need to check if the command to apply is in the log, and if it is, remove it
         // In this program this will always be true, because we just added it at the end of the vector, and it's the one
@@ -96,7 +339,7 @@ class Node {
         if (log_.empty()) return -1;
 
         // We also check again if this node is responsible for the specified operation.
-        if (!range_descriptor.replicas_id.contains(id_)) {
+        if (!range_descriptor.replicas_id.contains(id_) && !range_descriptor.non_voters_id.contains(id_)) {
             cout << "The specified range is not in this node" << endl;
             return -1;
         }
@@ -116,26 +359,49 @@ class Node {
         }
 
         log_.erase(log_.end() - 1);
+        applied_index_[range_descriptor.id] = max(applied_index_[range_descriptor.id], command.index);
+
+        if (IsWrite(command.type) && command.transaction_id != 0) return ApplyIntent(command);
+        if (IsWrite(command.type) && intents_.contains(command.key)) {
+            cout << "Key " << command.key << " has an intent of transaction "
+                 << intents_[command.key].transaction_id << endl;
+            return -1;
+        }
 
         switch (command.type) {
             case CREATE:
-                return ApplyCreate(command.key, command.value);
+                return ApplyCreate(command.key, command.value, command.timestamp);
             case UPDATE:
-                return ApplyUpdate(command.key, command.value);
+                return ApplyUpdate(command.key, command.value, command.timestamp);
             case DELETE:
-                return ApplyDelete(command.key);
+                return ApplyDelete(command.key, command.timestamp);
+            case END_TRANSACTION:
+                return ApplyEndTransaction(command);
+            case RESOLVE_INTENT:
+                return ApplyResolveIntent(command);
+            case ONE_PHASE_COMMIT:
+                return ApplyOnePhaseCommit(command, range_descriptor);
+            case PUSH_TRANSACTION:
+                return ApplyPushTransaction(command);
             default:
                 return -1;
         }
     }
 
     void PushCommandToLog(const Command &command) {
+        hlc_.Update(command.timestamp);
         log_.push_back(command);
         cout << "Command just pushed to Log of Node " + to_string(id_) << endl;
     }
 
     // This only executes in the leader
     int ProcessCommand(const Command &command, const RangeDescriptor &range_descriptor) {
+        if (!live_) {
+            cout << "Leader " << id_ << " is unavailable" << endl;
+            return -1;
+        }
+        hlc_.Update(command.timestamp);
+
         // check if this node is the leader of the specified range
         if (range_descriptor.leader_id != id_) {
             cout << "A node that is not the leader for a range cannot process a command" << endl;
@@ -150,13 +416,27 @@ class Node {
 
         // This is where most of the replication layer logic is.
 
-        // Replicate command to other nodes in the Range's Raft group, and wait until all have finished. In the real
-        // implementation, we would only wait for the majority of nodes to replicate the command.
+        // Replicate command to other nodes in the Range's Raft group, and wait until all live ones have finished. The
+        // command can only be committed if those are a majority of the replicas; replicas that are down will catch up
+        // through a snapshot once they come back.
         cout << "Starting pushing command to logs..." << endl << "Leader " << id_ << " goes first" << endl;
-        PushCommandToLog(command);
+        network_->RecordReplication(id_, range_descriptor.replicas_id);
+        Command entry = command;
+        entry.index = GetAppliedIndex(range_descriptor.id) + 1;
+        PushCommandToLog(entry);
+        int replicated = 1;
         for (auto replica_id: range_descriptor.replicas_id) {
             if (replica_id == id_) continue; // We've already added to the leader's log
-            nodes_[replica_id]->PushCommandToLog(command);
+            if (!nodes_[replica_id]->IsLive()) {
+                cout << "Replica " << replica_id << " is unavailable" << endl;
+                continue;
+            }
+            nodes_[replica_id]->PushCommandToLog(entry);
+            replicated++;
+        }
+        if (replicated <= (int) range_descriptor.replicas_id.size() / 2) {
+            cout << "Command could not be replicated to a majority of replicas" << endl;
+            return -1;
         }
 
         // Once all replicas have replicated the command, we are ready to commit. Thus, we send a commit message to all
@@ -164,20 +444,328 @@ class Node {
         // by the ApplyCommand method, which "receives" the commit message and applies the actual changes.
 
         cout << "Starting applying command in replicas..." << endl << "Leader " << id_ << " goes first" << endl;
-        int result = ApplyCommand(command, range_descriptor);
+        int result = ApplyCommand(entry, range_descriptor);
         // If we detect an error, we return it instead of continuing doing work. As a consequence, logs can have
         // uncommitted commands.
         if (result < 0) return result;
 
         for (auto replica_id : range_descriptor.replicas_id) {
             if (replica_id == id_) continue; // We've already applied the command in the leader
-            result = nodes_[replica_id]->ApplyCommand(command, range_descriptor);
+            if (!nodes_[replica_id]->IsLive()) continue;
+            result = nodes_[replica_id]->ApplyCommand(entry, range_descriptor);
             if (result < 0) return result;
         }
 
+        // Non-voting replicas receive the command once it has been committed, and the leader doesn't wait for them.
+        for (auto replica_id : range_descriptor.non_voters_id) {
+            if (!nodes_[replica_id]->IsLive()) continue;
+            nodes_[replica_id]->PushCommandToLog(entry);
+            nodes_[replica_id]->ApplyCommand(entry, range_descriptor);
+        }
+
+        return result;
+    }
+
+    [[nodiscard]] bool IsReplica(const RangeDescriptor &range_descriptor) const {
+        return range_descriptor.replicas_id.contains(id_) || range_descriptor.non_voters_id.contains(id_);
+    }
+
+    // Closest live replica of the Range to this node, or -1 if there is none.
+    [[nodiscard]] int ClosestReplica(const RangeDescriptor &range_descriptor) const {
+        int closest_id = -1;
+        auto consider = [&](int replica_id) {
+            if (!nodes_.at(replica_id)->IsLive()) return;
+            if (closest_id < 0 || network_->Latency(id_, replica_id) < network_->Latency(id_, closest_id)) {
+                closest_id = replica_id;
+            }
+        };
+        for (auto replica_id : range_descriptor.replicas_id) consider(replica_id);
+        for (auto replica_id : range_descriptor.non_voters_id) consider(replica_id);
+        return closest_id;
+    }
+
+    // Range to which the key belongs according to this node's copy of the range descriptor table, or nullptr if none.
+    [[nodiscard]] const RangeDescriptor *FindRange(int key) const {
+        auto it = interval_start_to_range_descriptor_.upper_bound(key);
+        if (it == interval_start_to_range_descriptor_.begin()) return nullptr;
+        return &prev(it)->second;
+    }
+
+    // Reads below the GC threshold of the Range could miss versions that were already garbage collected.
+    [[nodiscard]] static bool BelowGCThreshold(const Command &command, const RangeDescriptor &range_descriptor) {
+        if (!IsRead(command.type) || command.timestamp >= range_descriptor.gc_threshold) return false;
+        cout << "Timestamp " << ToString(command.timestamp) << " is below the GC threshold of the range" << endl;
+        return true;
+    }
+
+    // Sends a write of a transaction coordinated by this node, which leaves an intent on its key. The key is tracked
+    // even if the write fails, since resolving an intent that was never written does nothing. If pipelined, the write
+    // is answered as soon as the leaseholder evaluates and proposes it, so that the writes of the transaction replicate
+    // at the same time instead of one after the other, and it is tracked as in flight until it is proven.
+    int WriteIntent(Transaction &transaction, Command command, bool pipelined = false) {
+        command.timestamp = transaction.write_timestamp;
+        if (transaction.anchor_key < 0) transaction.anchor_key = command.key;
+        command.anchor_key = transaction.anchor_key;
+        command.async_consensus = pipelined;
+        transaction.intent_keys.insert(command.key);
+        Timestamp timestamp;
+        int result = SendCommand(command, -1, &timestamp);
+        if (result >= 0) transaction.write_timestamp = max(transaction.write_timestamp, timestamp);
+        if (result >= 0 && pipelined) transaction.in_flight_writes.insert(command.key);
         return result;
     }
 
+    // Checks that a pipelined write of the transaction was replicated, at the timestamp at which the transaction
+    // writes. If it wasn't, it can no longer be written at that timestamp, and -1 is returned.
+    int ProveWrite(const Transaction &transaction, int key) {
+        Command query{QUERY_INTENT, key, 0, transaction.write_timestamp};
+        query.transaction_id = transaction.id;
+        return SendCommand(query);
+    }
+
+    // Proves every in-flight write of the transaction at the same time, so it only costs the slowest of them. The
+    // transaction can only be aborted if any of them is missing.
+    int ProveInFlightWrites(Transaction &transaction) {
+        bool proven = true;
+        network_->BeginParallel();
+        for (auto key : transaction.in_flight_writes) {
+            network_->NextBranch();
+            if (ProveWrite(transaction, key) < 0) proven = false;
+        }
+        network_->EndParallel();
+        transaction.in_flight_writes.clear();
+        if (!proven) transaction.status = ABORTED;
+        return proven ? 0 : -1;
+    }
+
+    // Sends the writes buffered by a transaction as intents, once it can no longer commit in one phase. Since the
+    // client was already told that those writes succeeded, the transaction can only be aborted if any of them fails.
+    int FlushBufferedWrites(Transaction &transaction) {
+        transaction.one_phase_commit = false;
+        auto writes = std::move(transaction.buffered_writes);
+        transaction.buffered_writes.clear();
+        for (const auto &write : writes) {
+            if (WriteIntent(transaction, write, transaction.write_pipelining) < 0) {
+                transaction.status = ABORTED;
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+    // Commands of a transaction on a key with an in-flight write are only sent once that write is proven, so that they
+    // are ordered after it. The transaction can only be aborted if it is missing.
+    int ProveKey(Transaction &transaction, int key) {
+        if (!transaction.in_flight_writes.erase(key) || ProveWrite(transaction, key) >= 0) return 0;
+        transaction.status = ABORTED;
+        return -1;
+    }
+
+    // Returns true if all of the writes fall in the same Range.
+    bool InSingleRange(const vector<Command> &writes) const {
+        set<const RangeDescriptor *> ranges;
+        for (const auto &write : writes) ranges.insert(FindRange(write.key));
+        return ranges.size() <= 1;
+    }
+
+    // Turns the intents of a finished transaction into regular values or discards them. This happens once the client
+    // has already been answered, so it doesn't add to the latency of any request.
+    void ResolveIntents(long long transaction_id, const set<int> &keys, Timestamp timestamp,
+                        TransactionStatus status) {
+        network_->SetBackground(true);
+        for (auto key : keys) {
+            Command resolve{RESOLVE_INTENT, key, 0, timestamp};
+            resolve.transaction_id = transaction_id;
+            resolve.transaction_status = status;
+            SendCommand(resolve);
+        }
+        network_->SetBackground(false);
+    }
+
+    // Writes a STAGING record listing every intent of the transaction at the same time as it proves its in-flight
+    // writes (and writes those still buffered as intents), so that committing takes a single round of consensus instead
+    // of two: the transaction is implicitly committed as soon as the record and all of its intents (at or below the
+    // timestamp of the record) are written. Returns 1 if it is, 0 if some write was pushed above the record, so that it
+    // can only be committed explicitly, and -1 if the record or some write failed.
+    int ParallelCommit(Transaction &transaction) {
+        auto writes = std::move(transaction.buffered_writes);
+        transaction.buffered_writes.clear();
+        for (const auto &write : writes) {
+            if (transaction.anchor_key < 0) transaction.anchor_key = write.key;
+            transaction.intent_keys.insert(write.key);
+        }
+        Timestamp staging_timestamp = transaction.write_timestamp;
+        Command staging{END_TRANSACTION, transaction.anchor_key, 0, staging_timestamp};
+        staging.transaction_id = transaction.id;
+        staging.transaction_status = STAGING;
+        staging.intent_keys = transaction.intent_keys;
+
+        network_->BeginParallel();
+        bool staged = SendCommand(staging) >= 0;
+        bool written = true;
+        for (const auto &write : writes) {
+            network_->NextBranch();
+            if (WriteIntent(transaction, write) < 0) written = false;
+        }
+        for (auto key : transaction.in_flight_writes) {
+            network_->NextBranch();
+            if (ProveWrite(transaction, key) < 0) written = false;
+        }
+        transaction.in_flight_writes.clear();
+        network_->EndParallel();
+
+        if (crash_during_commit_) {
+            cout << "Node " << id_ << " crashed while committing transaction " << transaction.id << endl;
+            crash_during_commit_ = false;
+            live_ = false;
+        }
+        if (!staged || !written) return -1;
+        return transaction.write_timestamp <= staging_timestamp ? 1 : 0;
+    }
+
+    // Evaluated by the leaseholder: returns 0 if the key has an intent of the transaction at or below the timestamp of
+    // the command. Otherwise, the intent is prevented from being written later at that timestamp, by recording a read
+    // of the key at it, and -1 is returned.
+    int QueryIntent(const Command &command) {
+        auto intent = intents_.find(command.key);
+        if (intent != intents_.end() && intent->second.transaction_id == command.transaction_id
+            && intent->second.timestamp <= command.timestamp) {
+            return 0;
+        }
+        cout << "Intent of transaction " << command.transaction_id << " on key " << command.key << " is missing" << endl;
+        timestamp_cache_.Add(command.key, command.key, command.timestamp);
+        return -1;
+    }
+
+    // Decides the outcome of a transaction left STAGING by its coordinator: it committed if every one of its intents was
+    // written, and otherwise it is aborted, since the missing intents can no longer be written at its timestamp.
+    void RecoverTransaction(const TransactionRecord &record) {
+        cout << "Node " << id_ << " is recovering transaction " << record.id << endl;
+        network_->SetBackground(true);
+        bool committed = true;
+        for (auto key : record.intent_keys) {
+            Command query{QUERY_INTENT, key, 0, record.timestamp};
+            query.transaction_id = record.id;
+            if (SendCommand(query) < 0) committed = false;
+        }
+        auto status = committed ? COMMITTED : ABORTED;
+        Command end{END_TRANSACTION, record.anchor_key, 0, record.timestamp};
+        end.transaction_id = record.id;
+        end.transaction_status = status;
+        end.intent_keys = record.intent_keys;
+        int result = SendCommand(end);
+        network_->SetBackground(false);
+        if (result < 0) return;
+        ResolveIntents(record.id, record.intent_keys, record.timestamp, status);
+        cout << "Transaction " << record.id << " recovered as " << ToString(status) << endl;
+    }
+
+    // Pushes the transaction with an intent on a key out of the way of a command waiting for its lock, and returns true
+    // if the command can go ahead. Reads only need the transaction to commit above them, so its timestamp is pushed,
+    // while writes need it to abort, which only older transactions can do (or anyone, once its coordinator is no longer
+    // live); otherwise the push only checks whether the transaction already finished. Either way, the intent is updated
+    // right away, since the command already holds the latch on the key.
+    bool PushTransaction(int key, const Intent &intent, const Command &pusher,
+                         const RangeDescriptor &range_descriptor) {
+        Command push{PUSH_TRANSACTION, intent.anchor_key, 0, intent.timestamp};
+        push.transaction_id = intent.transaction_id;
+        bool older = pusher.transaction_id != 0 && pusher.timestamp < intent.timestamp;
+        if (IsRead(pusher.type)) {
+            push.timestamp = pusher.timestamp + 1;
+        } else if (older || !liveness_->IsLive(CoordinatorId(intent.transaction_id))) {
+            push.transaction_status = ABORTED;
+        }
+        Timestamp record_timestamp = 0;
+        int status = SendCommand(push, -1, &record_timestamp);
+        if (status < 0 || status == STAGING || (status == PENDING && !IsRead(pusher.type))) return false;
+        cout << "Transaction " << intent.transaction_id << " pushed by a command on key " << key << " is "
+             << ToString((TransactionStatus) status) << endl;
+
+        // The response to the push carries the timestamp of the record of the transaction, so the value of a
+        // committed one is written at the timestamp at which it committed.
+        Timestamp resolve_timestamp = status == PENDING ? push.timestamp : intent.timestamp;
+        if (status == COMMITTED) resolve_timestamp = max(resolve_timestamp, record_timestamp);
+        Command resolve{RESOLVE_INTENT, key, 0, resolve_timestamp};
+        resolve.transaction_id = intent.transaction_id;
+        resolve.transaction_status = (TransactionStatus) status;
+        return SendCommandToLeader(resolve, range_descriptor) >= 0;
+    }
+
+    // Called by the leaseholder once it holds the latches of a command. Every intent of another transaction that the
+    // command can't ignore is added to the lock table as a lock of that transaction, and the command waits in line for
+    // it, pushing the transaction once it is first (see PushTransaction). Since nodes evaluate one command at a time, a
+    // command can't wait for a transaction that is still running, so it gives up (as if it timed out) if the push
+    // fails, and -1 is returned.
+    int WaitForLocks(const Command &command, const RangeDescriptor &range_descriptor) {
+        vector<int> keys{command.key};
+        for (const auto &write : command.writes) keys.push_back(write.key);
+        if (command.type == SCAN) {
+            keys.clear();
+            auto last = intents_.upper_bound(command.value);
+            for (auto it = intents_.lower_bound(command.key); it != last; it++) keys.push_back(it->first);
+        }
+        for (auto key : keys) {
+            auto it = intents_.find(key);
+            if (it == intents_.end() || it->second.transaction_id == command.transaction_id) continue;
+            if (IsRead(command.type) && it->second.timestamp > command.timestamp) continue;
+            auto intent = it->second;
+            lock_table_.AddLock(key, intent.transaction_id);
+            auto push = [&](long long) { return PushTransaction(key, intent, command, range_descriptor); };
+            if (lock_table_.Wait(key, command.transaction_id, command.timestamp, push, false) < 0) {
+                cout << "Command on key " << key << " gave up waiting for transaction " << intent.transaction_id
+                     << endl;
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+    // Evaluated by the leaseholder once it holds the latches of a read-modify-write command: reads the latest value of
+    // the key (from the store of the leader if this node hasn't applied every write it proposed yet), and turns the
+    // command into the CREATE or UPDATE it results in, which is all that has to be replicated. Returns the new value of
+    // the key, or its current value if PUT_IF_ABSENT finds it (in which case the command is left as is, since there is
+    // nothing to write), and -1 if the condition of the command doesn't hold.
+    int EvaluateReadModifyWrite(Command &command, const RangeDescriptor &range_descriptor, bool caught_up) {
+        auto source = caught_up ? this : nodes_[range_descriptor.leader_id];
+        if (!source->IsLive()) return -1;
+        // Stands in for a read request to the leader: its store is read directly, and only the round trip is recorded.
+        if (source != this) network_->RecordRoundTrip(id_, source->id_);
+        // The key was read at the timestamp of the command, even if nothing ends up being written.
+        timestamp_cache_.Add(command.key, command.key, command.timestamp);
+        auto current = source->key_value_store_.Get(command.key);
+        switch (command.type) {
+            case CONDITIONAL_PUT:
+                if (current != command.expected_value) {
+                    cout << "Key " << command.key << " does not have the expected value " << command.expected_value
+                         << endl;
+                    return -1;
+                }
+                break;
+            case INCREMENT: {
+                int sum;
+                if (__builtin_add_overflow(command.value, current.value_or(0), &sum)) {
+                    cout << "Incrementing key " << command.key << " by " << command.value << " overflows" << endl;
+                    return -1;
+                }
+                command.value = sum;
+                if (command.value < 0) {
+                    cout << "Key " << command.key << " can't be decremented below 0" << endl;
+                    return -1;
+                }
+                break;
+            }
+            case PUT_IF_ABSENT:
+                if (current.has_value()) return *current;
+                break;
+            default:
+                return -1;
+        }
+        cout << "Leaseholder " << id_ << " evaluated read-modify-write on key " << command.key << " to value "
+             << command.value << endl;
+        command.type = current.has_value() ? UPDATE : CREATE;
+        return command.value;
+    }
+
     // This only executes in the leaseholder
     int SendCommandToLeader(const Command &command, const RangeDescriptor &range_descriptor) {
         // check if this node is the leaseholder of the specified range
@@ -187,20 +775,202 @@ class Node {
         }
 
         cout << "Leaseholder " << id_ << " proposed command to leader with id = " << range_descriptor.leader_id << endl;
-        return nodes_[range_descriptor.leader_id]->ProcessCommand(command, range_descriptor);
+        network_->RecordRoundTrip(id_, range_descriptor.leader_id);
+        auto leader = nodes_[range_descriptor.leader_id];
+        int result = leader->ProcessCommand(command, range_descriptor);
+        // The response of the leader carries the index of the command. Commands that failed to apply were not applied
+        // by the rest of the replicas either, so they don't need to be waited for.
+        if (!IsRead(command.type) && result >= 0) {
+            auto &lease_applied_index = lease_applied_index_[range_descriptor.id];
+            lease_applied_index = max(lease_applied_index, leader->GetAppliedIndex(range_descriptor.id));
+        }
+        return result;
     }
 
 public:
-    Node(int id, const map<int, RangeDescriptor> &interval_start_to_range_descriptor)
-            : id_{id}, interval_start_to_range_descriptor_{interval_start_to_range_descriptor} {
+    Node(int id, const map<int, RangeDescriptor> &interval_start_to_range_descriptor, SimulatedNetwork *network,
+         NodeLiveness *liveness, SimulatedClock *clock, const Locality &locality = {})
+            : id_{id}, interval_start_to_range_descriptor_{interval_start_to_range_descriptor}, network_{network},
+              liveness_{liveness}, clock_{clock}, hlc_{clock}, locality_{locality} {
+        network_->SetLocality(id_, locality_);
+        HeartbeatLiveness();
+    }
+
+    // Latest timestamp handed out by the hybrid logical clock of this node.
+    [[nodiscard]] Timestamp LastTimestamp() const {
+        return hlc_.Last();
+    }
+
+    [[nodiscard]] const Locality &GetLocality() const {
+        return locality_;
+    }
+
+    [[nodiscard]] bool IsLive() const {
+        return live_;
+    }
+
+    // Simulates the node crashing (live = false) or coming back.
+    void SetLive(bool live) {
+        live_ = live;
+    }
+
+    // A single heartbeat keeps alive every lease held by this node.
+    void HeartbeatLiveness() {
+        if (live_) liveness_->Heartbeat(id_);
     }
 
     void AssignNodes(const map<int, Node*> &nodes) {
         nodes_ = nodes;
     }
 
-    int SendCommand(const Command &command) {
-        cout << "Node " << id_ << " just received a command using key " << command.key << endl;
+    // Replaces this node's copy of the range descriptor table, e.g. after a Range has been split.
+    void UpdateRangeDescriptors(const map<int, RangeDescriptor> &interval_start_to_range_descriptor) {
+        interval_start_to_range_descriptor_ = interval_start_to_range_descriptor;
+    }
+
+    [[nodiscard]] RangeLoad GetRangeLoad(int range_id) const {
+        auto it = range_load_.find(range_id);
+        if (it == range_load_.end()) return {};
+        return it->second;
+    }
+
+    // Total number of keys stored in this node, as a stand-in for disk usage.
+    [[nodiscard]] int DiskUsage() const {
+        return key_value_store_.Count(INT_MIN, INT_MAX);
+    }
+
+    // Called on the leaseholder of every Range each tick. Writes are always evaluated at the current time, so the
+    // leaseholder can promise that no write will ever happen at or below CLOSED_TIMESTAMP_TARGET ticks ago, and
+    // publishes that closed timestamp to every live replica of the Range (which have applied all writes committed so
+    // far).
+    void PublishClosedTimestamps() {
+        if (!live_) return;
+        auto target = (long long) ((double) CLOSED_TIMESTAMP_TARGET * TICK_DURATION_MS);
+        Timestamp closed_timestamp = MakeTimestamp(max(0LL, WallTime(hlc_.Now()) - target));
+        for (const auto &[_, descriptor] : interval_start_to_range_descriptor_) {
+            if (descriptor.leaseholder_id != id_ || !liveness_->IsLeaseValid(id_, descriptor.lease_epoch)) continue;
+            auto replicas_id = descriptor.replicas_id;
+            replicas_id.insert(descriptor.non_voters_id.begin(), descriptor.non_voters_id.end());
+            for (auto replica_id : replicas_id) {
+                auto replica = nodes_[replica_id];
+                if (replica->IsLive()) replica->ReceiveClosedTimestamp(descriptor.id, closed_timestamp);
+            }
+        }
+    }
+
+    void ReceiveClosedTimestamp(int range_id, Timestamp timestamp) {
+        hlc_.Update(timestamp);
+        auto &closed_timestamp = closed_timestamp_[range_id];
+        closed_timestamp = max(closed_timestamp, timestamp);
+    }
+
+    [[nodiscard]] Timestamp ClosedTimestamp(int range_id) const {
+        auto it = closed_timestamp_.find(range_id);
+        return it == closed_timestamp_.end() ? 0 : it->second;
+    }
+
+    // Called on the replicas of a Range whose id changed hands: the new right-hand side of a split starts with the
+    // closed timestamp of the Range it was split from, and a merged Range with the lower one of the two Ranges.
+    void SetClosedTimestamp(int range_id, Timestamp timestamp) {
+        closed_timestamp_[range_id] = timestamp;
+    }
+
+    [[nodiscard]] long long FollowerReads() const {
+        return follower_reads_;
+    }
+
+    [[nodiscard]] long long GetAppliedIndex(int range_id) const {
+        auto it = applied_index_.find(range_id);
+        return it == applied_index_.end() ? 0 : it->second;
+    }
+
+    // Called on a replica that caught up through a snapshot taken at the given index of the Range.
+    void ForwardAppliedIndex(int range_id, long long index) {
+        auto &applied_index = applied_index_[range_id];
+        applied_index = max(applied_index, index);
+    }
+
+    [[nodiscard]] long long GetLeaseAppliedIndex(int range_id) const {
+        auto it = lease_applied_index_.find(range_id);
+        return it == lease_applied_index_.end() ? 0 : it->second;
+    }
+
+    // Called on the incoming leaseholder of a Range with the index of the last command proposed by the outgoing one.
+    void ForwardLeaseAppliedIndex(int range_id, long long index) {
+        auto &lease_applied_index = lease_applied_index_[range_id];
+        lease_applied_index = max(lease_applied_index, index);
+    }
+
+    // Called on the incoming leaseholder of a Range with the highest timestamp at which the keys in [start, end] may
+    // have been read by the outgoing one.
+    void ForwardTimestampCache(int start, int end, Timestamp timestamp) {
+        timestamp_cache_.Add(start, end, timestamp);
+    }
+
+    // Number of keys stored in this node inside [start, end].
+    [[nodiscard]] int CountKeys(int start, int end) const {
+        return key_value_store_.Count(start, end);
+    }
+
+    // Copy of the data inside [start, end], used to bring a new replica of a Range up to date.
+    [[nodiscard]] Snapshot GetSnapshot(int start, int end) const {
+        Snapshot snapshot;
+        snapshot.versions = key_value_store_.Versions(start, end);
+        snapshot.intents = {intents_.lower_bound(start), intents_.upper_bound(end)};
+        for (const auto &[id, record] : transaction_records_) {
+            if (record.anchor_key >= start && record.anchor_key <= end) snapshot.transaction_records[id] = record;
+        }
+        return snapshot;
+    }
+
+    void ApplySnapshot(const Snapshot &snapshot) {
+        cout << "Applying snapshot of " << snapshot.versions.size() << " keys in node " << id_ << endl;
+        key_value_store_.Ingest(snapshot.versions);
+        for (const auto &[key, intent] : snapshot.intents) intents_[key] = intent;
+        for (const auto &[id, record] : snapshot.transaction_records) transaction_records_[id] = record;
+    }
+
+    // Removes the data inside [start, end] once this node no longer holds a replica of the Range.
+    void ClearRange(int start, int end) {
+        cout << "Clearing keys in [" << start << ", " << end << "] from node " << id_ << endl;
+        key_value_store_.Clear(start, end);
+        intents_.erase(intents_.lower_bound(start), intents_.upper_bound(end));
+        erase_if(transaction_records_, [&](const auto &entry) {
+            return entry.second.anchor_key >= start && entry.second.anchor_key <= end;
+        });
+    }
+
+    // Called on every replica of a Range by the GC queue once its GC threshold has been moved forward, to remove the
+    // versions of its keys that reads can no longer see. Returns how many versions were removed.
+    int GarbageCollect(const RangeDescriptor &range_descriptor) {
+        if (!live_) return 0;
+        return key_value_store_.GarbageCollect(range_descriptor.start, range_descriptor.end,
+                                               range_descriptor.gc_threshold);
+    }
+
+    // Starts a new measuring window for the load of every Range.
+    void ResetRangeLoad() {
+        for (auto &[_, load] : range_load_) load.Reset();
+    }
+
+    // The gateway is the node that first received the command from the client (-1 if it is this node).
+    // If given, timestamp is set to the timestamp at which the command was evaluated, which can be higher than the one
+    // it was sent with, and rows is filled with the keys and values read by a SCAN.
+    int SendCommand(Command command, int gateway_id = -1, Timestamp *timestamp = nullptr,
+                    map<int, int> *rows = nullptr) {
+        if (gateway_id < 0) gateway_id = id_;
+        if (!live_) {
+            cout << "Node " << id_ << " is unavailable" << endl;
+            return -1;
+        }
+        // Reads of the latest values outside of a transaction are stamped by the leaseholder, whose clock is at least
+        // as high as the timestamp of every write it evaluated, so that they don't miss any of them.
+        bool latest = IsRead(command.type) && command.transaction_id == 0 && command.timestamp == 0;
+        if (command.timestamp == 0 && !latest) command.timestamp = hlc_.Now();
+        else hlc_.Update(command.timestamp);
+        if (timestamp != nullptr) *timestamp = command.timestamp;
+        cout << "Node " << id_ << " just received a command using key " << command.key << " at timestamp "
+             << ToString(command.timestamp) << endl;
         if (interval_start_to_range_descriptor_.empty()) {
             cout << "Lookup table for ranges is empty" << endl;
             return -1;
@@ -215,22 +985,355 @@ public:
         it--;
 
         auto range_descriptor = it->second;
+        if (command.type == SCAN && command.value > range_descriptor.end) {
+            cout << "Scan of [" << command.key << ", " << command.value << "] spans more than one range" << endl;
+            return -1;
+        }
+
+        // Reads at a past timestamp can be served by any replica that has closed that timestamp, so they are sent to
+        // the closest replica instead of the leaseholder, and only reach the leaseholder if that replica can't serve
+        // them.
+        bool closed = !latest && command.timestamp <= FollowerReadTimestamp(clock_->Now());
+        if (IsRead(command.type) && closed && range_descriptor.leaseholder_id != id_) {
+            if (IsReplica(range_descriptor)) {
+                auto closed_timestamp = closed_timestamp_.find(range_descriptor.id);
+                // Intents that the read can't ignore have to be pushed by the leaseholder.
+                int end = command.type == SCAN ? command.value : command.key;
+                bool conflict = false;
+                for (auto intent = intents_.lower_bound(command.key); intent != intents_.end() && intent->first <= end;
+                     intent++) {
+                    if (intent->second.transaction_id != command.transaction_id
+                        && intent->second.timestamp <= command.timestamp) {
+                        conflict = true;
+                    }
+                }
+                if (closed_timestamp != closed_timestamp_.end() && closed_timestamp->second >= command.timestamp
+                    && !conflict) {
+                    if (BelowGCThreshold(command, range_descriptor)) return -1;
+                    cout << "Follower " << id_ << " serves " << (command.type == SCAN ? "SCAN" : "READ")
+                         << " at timestamp " << ToString(command.timestamp) << endl;
+                    follower_reads_++;
+                    return command.type == SCAN ? ApplyScan(command, rows) : ApplyRead(command);
+                }
+            } else {
+                int closest_id = ClosestReplica(range_descriptor);
+                if (closest_id >= 0 && closest_id != range_descriptor.leaseholder_id) {
+                    cout << "Node " << id_ << " forwarded follower read to replica with id = " << closest_id << endl;
+                    network_->RecordRoundTrip(id_, closest_id);
+                    return nodes_[closest_id]->SendCommand(command, gateway_id, timestamp, rows);
+                }
+            }
+        }
 
         // This is the leaseholder for the appropriate Range
         if (range_descriptor.leaseholder_id == id_) {
             cout << "Node " << id_ << " is the appropriate leaseholder for range:" << endl;
             print_range_descriptor(range_descriptor);
-            return SendCommandToLeader(command, range_descriptor);
+            if (!liveness_->IsLeaseValid(id_, range_descriptor.lease_epoch)) {
+                cout << "The lease of node " << id_ << " for this range is no longer valid" << endl;
+                return -1;
+            }
+            if (clock_->Now() < range_descriptor.lease_start) {
+                cout << "Waiting for the lease of node " << id_ << " for this range to start" << endl;
+                network_->RecordWait((double) (range_descriptor.lease_start - clock_->Now()) * TICK_DURATION_MS);
+            }
+            if (latest) {
+                command.timestamp = hlc_.Now();
+                if (timestamp != nullptr) *timestamp = command.timestamp;
+            }
+            if (BelowGCThreshold(command, range_descriptor)) return -1;
+            // Held until the command has been evaluated and replicated.
+            LatchAccess access = IsRead(command.type) || command.type == QUERY_INTENT ? READ_LATCH : WRITE_LATCH;
+            int latch_start = command.key;
+            int latch_end = command.type == SCAN ? command.value : command.key;
+            for (const auto &write : command.writes) {
+                latch_start = min(latch_start, write.key);
+                latch_end = max(latch_end, write.key);
+            }
+            bool record = command.type == END_TRANSACTION || command.type == PUSH_TRANSACTION;
+            LatchGuard latch{record ? &record_latch_manager_ : &latch_manager_, {latch_start, latch_end, access}};
+            if (command.type == QUERY_INTENT) return QueryIntent(command);
+            bool locking = IsRead(command.type) || IsWrite(command.type) || IsReadModifyWrite(command.type)
+                           || command.type == ONE_PHASE_COMMIT;
+            if (locking && WaitForLocks(command, range_descriptor) < 0) return -1;
+            if (IsRead(command.type)) {
+                // Writes can't be applied at or below the closed timestamp anyway, so reads there aren't recorded.
+                if (command.timestamp > ClosedTimestamp(range_descriptor.id)) {
+                    timestamp_cache_.Add(command.key, latch_end, command.timestamp, command.transaction_id);
+                }
+            } else if (IsWrite(command.type) || IsReadModifyWrite(command.type)) {
+                // Writes can't be applied at or below a timestamp at which the key was read by someone else, nor at or
+                // below the closed timestamp of the Range (which only matters for transactions, since they can write
+                // at the timestamp they started at), nor below the latest version of the key, which would rewrite
+                // history that may already have been read.
+                Timestamp read_timestamp = timestamp_cache_.Lookup(command.key, command.key, command.transaction_id);
+                read_timestamp = max(read_timestamp, ClosedTimestamp(range_descriptor.id));
+                read_timestamp = max(read_timestamp, key_value_store_.LatestTimestamp(command.key));
+                if (command.timestamp <= read_timestamp) {
+                    cout << "Write to key " << command.key << " pushed above timestamp " << ToString(read_timestamp)
+                         << endl;
+                    command.timestamp = hlc_.Update(read_timestamp);
+                    if (timestamp != nullptr) *timestamp = command.timestamp;
+                }
+            } else if (command.type == ONE_PHASE_COMMIT) {
+                // A transaction committing in one phase can't be pushed, since it is committed as soon as it is
+                // applied, so its coordinator has to fall back to writing intents instead.
+                Timestamp read_timestamp = ClosedTimestamp(range_descriptor.id);
+                for (const auto &write : command.writes) {
+                    read_timestamp = max(read_timestamp,
+                                         timestamp_cache_.Lookup(write.key, write.key, command.transaction_id));
+                    read_timestamp = max(read_timestamp, key_value_store_.LatestTimestamp(write.key));
+                }
+                if (command.timestamp <= read_timestamp) {
+                    cout << "One-phase commit of transaction " << command.transaction_id << " would be pushed above "
+                         << ToString(read_timestamp) << endl;
+                    return -1;
+                }
+            }
+            range_load_[range_descriptor.id].Record(command.key, gateway_id);
+            // Every write to the Range goes through the leaseholder, so once it has applied the last one it proposed,
+            // its own store is up to date and it can serve reads without involving the leader.
+            bool caught_up = GetAppliedIndex(range_descriptor.id) >= GetLeaseAppliedIndex(range_descriptor.id);
+            if (command.type == READ && caught_up) {
+                cout << "Leaseholder " << id_ << " serves READ from its own store" << endl;
+                return ApplyRead(command);
+            }
+            if (IsReadModifyWrite(command.type)) {
+                int result = EvaluateReadModifyWrite(command, range_descriptor, caught_up);
+                if (result < 0 || IsReadModifyWrite(command.type)) return result;
+                return SendCommandToLeader(command, range_descriptor) < 0 ? -1 : result;
+            }
+            if (command.type == SCAN) {
+                // Scans are not replicated either, so a leaseholder that is behind has the leader evaluate them.
+                auto node = caught_up ? this : nodes_[range_descriptor.leader_id];
+                if (!node->IsLive()) return -1;
+                if (node != this) network_->RecordRoundTrip(id_, node->id_);
+                cout << "Node " << node->id_ << " serves SCAN from its own store" << endl;
+                return node->ApplyScan(command, rows);
+            }
+            if (command.type == PUSH_TRANSACTION) {
+                // The response carries the status of the record and, through timestamp, the timestamp it has after
+                // the push (the one at which the transaction committed, if it did).
+                int status = SendCommandToLeader(command, range_descriptor);
+                auto record = transaction_records_.find(command.transaction_id);
+                if (status >= 0 && timestamp != nullptr && record != transaction_records_.end()) {
+                    *timestamp = record->second.timestamp;
+                }
+                return status;
+            }
+            bool pipelined = command.async_consensus && command.transaction_id != 0 && IsWrite(command.type);
+            if (!pipelined || !caught_up || network_->Background()) {
+                return SendCommandToLeader(command, range_descriptor);
+            }
+            // Errors found while evaluating the command are still returned, but the leaseholder answers as soon as
+            // the command is proposed: its replication doesn't add to the latency of the request, and if it fails,
+            // the client only finds out once the coordinator tries to prove the write (see ProveWrite).
+            if (EvaluateIntent(command) < 0) return -1;
+            cout << "Leaseholder " << id_ << " answers before the command is replicated" << endl;
+            network_->SetBackground(true);
+            if (SendCommandToLeader(command, range_descriptor) < 0) {
+                cout << "Pipelined write of transaction " << command.transaction_id << " on key " << command.key
+                     << " failed to replicate" << endl;
+            }
+            network_->SetBackground(false);
+            return 0;
         }
 
         // Forward the Command to the leaseholder
         cout << "Node " << id_ << " forwarded command to leaseholder with id = " << range_descriptor.leaseholder_id
              << endl;
-        return nodes_[range_descriptor.leaseholder_id]->SendCommand(command);
+        network_->RecordRoundTrip(id_, range_descriptor.leaseholder_id);
+        return nodes_[range_descriptor.leaseholder_id]->SendCommand(command, gateway_id, timestamp, rows);
+    }
+
+    // Starts a transaction coordinated by this node, and returns its id. If one_phase_commit is set, its writes are
+    // buffered for as long as all of them fall in the same Range, so any error they run into is only reported when
+    // committing. If write_pipelining is set, the writes it sends before committing are pipelined (see WriteIntent),
+    // which they always are if parallel_commit is set, since it proves them in parallel with its record.
+    long long BeginTransaction(bool one_phase_commit = false, bool parallel_commit = false,
+                               bool write_pipelining = false) {
+        long long id = MakeTransactionId(id_, next_transaction_sequence_++);
+        Timestamp timestamp = hlc_.Now();
+        transactions_[id] = {id, PENDING, timestamp, timestamp};
+        transactions_[id].one_phase_commit = one_phase_commit;
+        transactions_[id].parallel_commit = parallel_commit;
+        transactions_[id].write_pipelining = write_pipelining || parallel_commit;
+        cout << "Node " << id_ << " started transaction " << id << " at timestamp " << ToString(timestamp) << endl;
+        return id;
+    }
+
+    // Starts a read-only transaction coordinated by this node that reads at the given timestamp (or at the current
+    // time, if it is 0), and returns its id.
+    long long BeginReadOnlyTransaction(Timestamp timestamp) {
+        long long id = MakeTransactionId(id_, next_transaction_sequence_++);
+        if (timestamp == 0) timestamp = hlc_.Now();
+        transactions_[id] = {id, PENDING, timestamp, timestamp};
+        transactions_[id].read_only = true;
+        cout << "Node " << id_ << " started read-only transaction " << id << " at timestamp " << ToString(timestamp)
+             << endl;
+        return id;
+    }
+
+    // Sends a READ or a write as part of a transaction coordinated by this node. Writes leave an intent on their key,
+    // which the transaction sees in later reads, and which is only turned into a regular value once the transaction
+    // commits.
+    int SendTransactionalCommand(long long transaction_id, Command command) {
+        if (!live_) {
+            cout << "Node " << id_ << " is unavailable" << endl;
+            return -1;
+        }
+        auto it = transactions_.find(transaction_id);
+        if (it == transactions_.end()) {
+            cout << "Transaction " << transaction_id << " is not pending in node " << id_ << endl;
+            return -1;
+        }
+        if (command.type != READ && !IsWrite(command.type)) {
+            cout << "Only reads and writes can be sent as part of a transaction" << endl;
+            return -1;
+        }
+        auto &transaction = it->second;
+        if (transaction.status != PENDING) {
+            cout << "Transaction " << transaction_id << " failed and can only be aborted" << endl;
+            return -1;
+        }
+        if (transaction.read_only && command.type != READ) {
+            cout << "Transaction " << transaction_id << " is read-only" << endl;
+            return -1;
+        }
+        command.transaction_id = transaction_id;
+        if (command.type == READ) {
+            // Reading a key with a buffered write needs that write to be sent first.
+            bool buffered = any_of(transaction.buffered_writes.begin(), transaction.buffered_writes.end(),
+                                   [&](const Command &write) { return write.key == command.key; });
+            if (buffered && FlushBufferedWrites(transaction) < 0) return -1;
+            if (ProveKey(transaction, command.key) < 0) return -1;
+            command.timestamp = transaction.read_timestamp;
+            transaction.read_keys.insert(command.key);
+            return SendCommand(command);
+        }
+
+        if (transaction.one_phase_commit) {
+            transaction.buffered_writes.push_back(command);
+            if (InSingleRange(transaction.buffered_writes)) {
+                cout << "Transaction " << transaction_id << " buffered write to key " << command.key << endl;
+                return 0;
+            }
+            transaction.buffered_writes.pop_back();
+            if (FlushBufferedWrites(transaction) < 0) return -1;
+        }
+        if (ProveKey(transaction, command.key) < 0) return -1;
+        return WriteIntent(transaction, command, transaction.write_pipelining);
+    }
+
+    // Finishes a transaction coordinated by this node. Its record is written with the final status in the Range of its
+    // anchor key, which commits (or aborts) every one of its intents at once, and then the intents are resolved in the
+    // background, since the client can already be answered. A transaction that was pushed after reading can't commit,
+    // since its reads may no longer be valid at its commit timestamp, so it is aborted instead and must be retried.
+    // A transaction whose writes are still buffered (all of them in the same Range) commits in one phase instead: its
+    // writes are applied as a single command, without any intent nor record, and only if that fails are they sent as
+    // intents (in parallel with the record, if the transaction uses parallel commits). Transactions with parallel commits
+    // write a STAGING record in parallel with proving their in-flight writes, after which they are already committed,
+    // so their record is made explicit in the background.
+    int EndTransaction(long long transaction_id, bool commit) {
+        if (!live_) {
+            cout << "Node " << id_ << " is unavailable" << endl;
+            return -1;
+        }
+        auto it = transactions_.find(transaction_id);
+        if (it == transactions_.end()) {
+            cout << "Transaction " << transaction_id << " is not pending in node " << id_ << endl;
+            return -1;
+        }
+        auto transaction = it->second;
+        transactions_.erase(it);
+
+        auto status = commit ? COMMITTED : ABORTED;
+        if (commit && transaction.status == ABORTED) {
+            cout << "Transaction " << transaction_id << " failed to write its intents" << endl;
+            status = ABORTED;
+        }
+        // A transaction whose writes were pushed above the timestamp at which it read can't commit, since what it read
+        // may have changed by the timestamp at which it would commit. This is checked before committing in one phase
+        // or staging the record, since either of those may commit it right away, and again once the writes it still
+        // had to send have been proven.
+        auto stale_reads = [&]() {
+            if (transaction.write_timestamp <= transaction.read_timestamp || transaction.read_keys.empty()) return false;
+            cout << "Transaction " << transaction_id << " read at " << ToString(transaction.read_timestamp)
+                 << " but was pushed to " << ToString(transaction.write_timestamp) << ", so it must be retried" << endl;
+            return true;
+        };
+        if (status == COMMITTED && stale_reads()) status = ABORTED;
+        bool one_phase = transaction.one_phase_commit && InSingleRange(transaction.buffered_writes);
+        if (status == COMMITTED && !transaction.buffered_writes.empty() && one_phase) {
+            Command batch{ONE_PHASE_COMMIT, transaction.buffered_writes.front().key, 0, transaction.write_timestamp};
+            batch.transaction_id = transaction_id;
+            batch.writes = transaction.buffered_writes;
+            if (SendCommand(batch) >= 0) {
+                cout << "Transaction " << transaction_id << " committed in one phase" << endl;
+                return 0;
+            }
+            if (!transaction.parallel_commit && FlushBufferedWrites(transaction) < 0) status = ABORTED;
+        }
+        bool implicitly_committed = false;
+        bool has_writes = !transaction.buffered_writes.empty() || !transaction.intent_keys.empty();
+        if (status == COMMITTED && transaction.parallel_commit && has_writes) {
+            int result = ParallelCommit(transaction);
+            if (!live_) {
+                cout << "The outcome of transaction " << transaction_id << " is unknown to the client" << endl;
+                return -1;
+            }
+            if (result < 0) status = ABORTED;
+            implicitly_committed = result > 0;
+        }
+        if (status == COMMITTED && !implicitly_committed && ProveInFlightWrites(transaction) < 0) {
+            cout << "Transaction " << transaction_id << " has writes that were not replicated" << endl;
+            status = ABORTED;
+        }
+        if (status == COMMITTED && !implicitly_committed && stale_reads()) status = ABORTED;
+        if (transaction.intent_keys.empty()) return status == COMMITTED || !commit ? 0 : -1;
+
+        Command end{END_TRANSACTION, transaction.anchor_key, 0, transaction.write_timestamp};
+        end.transaction_id = transaction_id;
+        end.transaction_status = status;
+        end.intent_keys = transaction.intent_keys;
+        network_->SetBackground(implicitly_committed);
+        int result = SendCommand(end);
+        network_->SetBackground(false);
+        if (result < 0 && !implicitly_committed) {
+            cout << "Could not write the record of transaction " << transaction_id << endl;
+            status = ABORTED;
+        }
+
+        ResolveIntents(transaction_id, transaction.intent_keys, transaction.write_timestamp, status);
+
+        cout << "Transaction " << transaction_id << " finished as " << ToString(status) << endl;
+        return status == (commit ? COMMITTED : ABORTED) ? 0 : -1;
+    }
+
+    // Called on every node each tick. Transactions anchored in the Ranges leased by this node that were left STAGING by
+    // a coordinator that is no longer live are recovered (see RecoverTransaction).
+    void RecoverTransactions() {
+        if (!live_) return;
+        vector<TransactionRecord> abandoned;
+        for (const auto &[id, record] : transaction_records_) {
+            if (record.status != STAGING || liveness_->IsLive(CoordinatorId(id))) continue;
+            auto range_descriptor = FindRange(record.anchor_key);
+            if (range_descriptor != nullptr && range_descriptor->leaseholder_id == id_) abandoned.push_back(record);
+        }
+        for (const auto &record : abandoned) RecoverTransaction(record);
+    }
+
+    void CrashDuringNextCommit() {
+        crash_during_commit_ = true;
+    }
+
+    // Time each key leased by this node was locked by a transaction while some command wanted it, in milliseconds.
+    map<int, double> Contention() {
+        return lock_table_.Contention();
     }
 
     void Print() {
-        cout << "Node with ID = " + to_string(id_) << endl;
+        cout << "Node with ID = " + to_string(id_) << " (" << ToString(locality_) << ")" << endl;
         cout << "Log: [ ";
         for (const auto &command : log_) {
             cout << "{ type: " << command.type << ", key: "
@@ -238,10 +1341,18 @@ public:
         }
         cout << "]" << endl;
         cout << "Key-Value store: [ ";
-        for (const auto &[key, value] : key_value_store_) {
+        for (const auto &[key, value] : key_value_store_.Scan(INT_MIN, INT_MAX)) {
             cout << "{ " << key << ", " << value << " }, ";
         }
-        cout << "]" << endl << endl << endl;
+        cout << "]" << endl;
+        if (!intents_.empty()) {
+            cout << "Intents: [ ";
+            for (const auto &[key, intent] : intents_) {
+                cout << "{ " << key << ", transaction: " << intent.transaction_id << " }, ";
+            }
+            cout << "]" << endl;
+        }
+        cout << endl << endl;
     }
 };
 
@@ -0,0 +1,76 @@
+#include <bits/stdc++.h>
+
+using namespace std;
+
+#ifndef CRDB_REPLICATION_LAYER_RANGE_LOAD_H
+#define CRDB_REPLICATION_LAYER_RANGE_LOAD_H
+
+// Maximum number of keys kept in the reservoir sample of a Range.
+const int RANGE_LOAD_SAMPLE_SIZE = 20;
+
+// Load statistics that the leaseholder keeps for each of its Ranges. The number of requests is accumulated during the
+// current tick, so that it can be read as a request rate, and the keys of those requests are sampled (reservoir
+// sampling) in order to find a split key that divides the load evenly, instead of one that divides the key space
+// evenly. The number of requests that arrived through each gateway node is instead decayed by half every tick, since a
+// single tick is usually too short to tell where the requests of a Range come from.
+class RangeLoad {
+    int requests_ = 0;
+    int samples_seen_ = 0;
+    vector<int> sampled_keys_;
+    map<int, double> requests_by_origin_;
+
+public:
+    void Record(int key, int origin_id) {
+        requests_++;
+        requests_by_origin_[origin_id]++;
+        samples_seen_++;
+        if ((int) sampled_keys_.size() < RANGE_LOAD_SAMPLE_SIZE) {
+            sampled_keys_.push_back(key);
+            return;
+        }
+        // Every key seen so far has the same probability of being in the sample.
+        int slot = rand() % samples_seen_;
+        if (slot < RANGE_LOAD_SAMPLE_SIZE) sampled_keys_[slot] = key;
+    }
+
+    [[nodiscard]] int Requests() const {
+        return requests_;
+    }
+
+    // Decayed number of requests that arrived through each gateway node.
+    [[nodiscard]] const map<int, double> &RequestsByOrigin() const {
+        return requests_by_origin_;
+    }
+
+    // Returns the sampled key that best balances the requests to its left and to its right, or -1 if there is no such
+    // key inside (start, end]. Splitting at start would leave an empty left-hand side, so it is never chosen.
+    [[nodiscard]] int FindSplitKey(int start, int end) const {
+        vector<int> keys = sampled_keys_;
+        sort(keys.begin(), keys.end());
+
+        int best_key = -1;
+        int best_imbalance = INT_MAX;
+        for (int i = 0; i < (int) keys.size(); i++) {
+            if (keys[i] <= start || keys[i] > end) continue;
+            // Requests for keys in [start, keys[i]) go left and the rest go right.
+            int left = (int) (lower_bound(keys.begin(), keys.end(), keys[i]) - keys.begin());
+            int right = (int) keys.size() - left;
+            int imbalance = abs(left - right);
+            if (imbalance < best_imbalance) {
+                best_imbalance = imbalance;
+                best_key = keys[i];
+            }
+        }
+        return best_key;
+    }
+
+    // Starts the measuring window of a new tick.
+    void Reset() {
+        requests_ = 0;
+        samples_seen_ = 0;
+        sampled_keys_.clear();
+        for (auto &[_, requests] : requests_by_origin_) requests /= 2;
+    }
+};
+
+#endif //CRDB_REPLICATION_LAYER_RANGE_LOAD_H
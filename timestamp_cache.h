@@ -0,0 +1,127 @@
+#include <bits/stdc++.h>
+#include "hlc.h"
+
+using namespace std;
+
+#ifndef CRDB_REPLICATION_LAYER_TIMESTAMP_CACHE_H
+#define CRDB_REPLICATION_LAYER_TIMESTAMP_CACHE_H
+
+// Number of independently locked shards of a timestamp cache.
+const int TIMESTAMP_CACHE_SHARDS = 16;
+// Maximum number of spans kept by each shard before the oldest ones are evicted.
+const int TIMESTAMP_CACHE_SHARD_CAPACITY = 256;
+
+// Highest timestamp at which each span of keys was read, kept by the leaseholder so that no write is ever applied below
+// a read that has already been served. Spans are kept in shards by key (a span that covers several keys is added to
+// every shard), each one with its own lock, so that commands on different keys don't contend with each other. Each
+// shard keeps a bounded number of spans: once it is full, the span with the lowest timestamp is evicted and the
+// low-water mark of the shard is raised to that timestamp, which keeps every lookup conservative. Each span also keeps
+// the transaction that read it (0 if none, or if several reads share its timestamp), so that a transaction's writes
+// are not pushed above its own reads.
+class TimestampCache {
+    // (timestamp, transaction id) of a read.
+    typedef pair<Timestamp, long long> Read;
+
+    struct Shard {
+        std::mutex mutex;
+        // Latest read of each span, by (start, end).
+        map<pair<int, int>, Read> spans;
+        // Spans covering more than one key, which are few (e.g. those added when a lease is acquired), but can overlap a
+        // lookup even if they start before it.
+        set<pair<int, int>> wide_spans;
+        // The same spans ordered by timestamp, to find the one to evict.
+        set<pair<Timestamp, pair<int, int>>> by_timestamp;
+        // Every key was read at or below this timestamp, unless the cache holds a higher one for it.
+        Timestamp low_water_mark = 0;
+    };
+
+    vector<Shard> shards_;
+    int capacity_;
+
+    [[nodiscard]] int ShardIndex(int key) const {
+        return key % (int) shards_.size();
+    }
+
+    // Shards that may hold spans overlapping [start, end].
+    [[nodiscard]] vector<int> ShardIndexes(int start, int end) const {
+        vector<int> indexes;
+        for (int key = start; key <= end && (int) indexes.size() < (int) shards_.size(); key++) {
+            indexes.push_back(ShardIndex(key));
+        }
+        return indexes;
+    }
+
+    // Latest of two reads. Reads at the same timestamp by different transactions are not attributed to any of them.
+    static Read Latest(const Read &a, const Read &b) {
+        if (a.first != b.first) return a.first > b.first ? a : b;
+        return {a.first, a.second == b.second ? a.second : 0};
+    }
+
+    void Add(Shard &shard, int start, int end, Timestamp timestamp, long long transaction_id) {
+        lock_guard<std::mutex> lock{shard.mutex};
+        if (timestamp <= shard.low_water_mark) return;
+        auto it = shard.spans.find({start, end});
+        if (it != shard.spans.end()) {
+            if (it->second.first > timestamp) return;
+            shard.by_timestamp.erase({it->second.first, it->first});
+            it->second = Latest(it->second, {timestamp, transaction_id});
+        } else {
+            shard.spans[{start, end}] = {timestamp, transaction_id};
+            if (start < end) shard.wide_spans.insert({start, end});
+        }
+        shard.by_timestamp.insert({timestamp, {start, end}});
+
+        while ((int) shard.spans.size() > capacity_) {
+            auto oldest = shard.by_timestamp.begin();
+            shard.low_water_mark = max(shard.low_water_mark, oldest->first);
+            shard.spans.erase(oldest->second);
+            shard.wide_spans.erase(oldest->second);
+            shard.by_timestamp.erase(oldest);
+        }
+    }
+
+    Read Lookup(Shard &shard, int start, int end) {
+        lock_guard<std::mutex> lock{shard.mutex};
+        Read read{shard.low_water_mark, 0};
+        // Every span starting inside [start, end] overlaps it.
+        auto first = shard.spans.lower_bound({start, INT_MIN});
+        auto last = shard.spans.upper_bound({end, INT_MAX});
+        for (auto it = first; it != last; it++) read = Latest(read, it->second);
+        // Spans starting before it only overlap it if they are wide enough.
+        for (const auto &span : shard.wide_spans) {
+            if (span.first >= start) break;
+            if (span.second >= start) read = Latest(read, shard.spans[span]);
+        }
+        return read;
+    }
+
+public:
+    explicit TimestampCache(int shards = TIMESTAMP_CACHE_SHARDS, int capacity = TIMESTAMP_CACHE_SHARD_CAPACITY)
+            : shards_(shards), capacity_{capacity} {
+    }
+
+    // Records a read of the keys in [start, end] at the given timestamp, by the given transaction (0 if none).
+    void Add(int start, int end, Timestamp timestamp, long long transaction_id = 0) {
+        for (auto index : ShardIndexes(start, end)) Add(shards_[index], start, end, timestamp, transaction_id);
+    }
+
+    // Highest timestamp at which any key in [start, end] may have been read, or 0 if the latest read was done by the
+    // given transaction itself (every other read being at a lower timestamp).
+    Timestamp Lookup(int start, int end, long long transaction_id = 0) {
+        Read read{0, 0};
+        for (auto index : ShardIndexes(start, end)) read = Latest(read, Lookup(shards_[index], start, end));
+        return transaction_id != 0 && read.second == transaction_id ? 0 : read.first;
+    }
+
+    // Number of spans currently kept, across all shards.
+    [[nodiscard]] int Size() {
+        int size = 0;
+        for (auto &shard : shards_) {
+            lock_guard<std::mutex> lock{shard.mutex};
+            size += (int) shard.spans.size();
+        }
+        return size;
+    }
+};
+
+#endif //CRDB_REPLICATION_LAYER_TIMESTAMP_CACHE_H
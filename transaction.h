@@ -0,0 +1,83 @@
+#include <bits/stdc++.h>
+#include "command.h"
+
+using namespace std;
+
+#ifndef CRDB_REPLICATION_LAYER_TRANSACTION_H
+#define CRDB_REPLICATION_LAYER_TRANSACTION_H
+
+string ToString(TransactionStatus status) {
+    switch (status) {
+        case PENDING:
+            return "PENDING";
+        case STAGING:
+            return "STAGING";
+        case COMMITTED:
+            return "COMMITTED";
+        default:
+            return "ABORTED";
+    }
+}
+
+// Transaction ids carry the id of the node coordinating the transaction in their upper 32 bits, so that any node can
+// tell where to send the commands of a transaction. 0 means no transaction.
+long long MakeTransactionId(int coordinator_id, long long sequence) {
+    return ((long long) coordinator_id << 32) | sequence;
+}
+
+int CoordinatorId(long long transaction_id) {
+    return (int) (transaction_id >> 32);
+}
+
+// Provisional value written by a transaction. It is only visible to the transaction that wrote it until the
+// transaction commits (and the intent is resolved into a regular value) or aborts (and the intent is discarded), and
+// any other command that finds it must not ignore it.
+struct Intent {
+    long long transaction_id;
+    // CREATE and UPDATE intents replace the value of the key once committed, while DELETE intents remove it.
+    OpType type;
+    int value;
+    Timestamp timestamp;
+    int anchor_key;
+};
+
+// Replicated record of a transaction, stored in the Range of its anchor key (the first key it wrote). It is the single
+// source of truth about whether the transaction committed, so writing it is what makes the transaction atomic.
+struct TransactionRecord {
+    long long id;
+    TransactionStatus status = PENDING;
+    int anchor_key;
+    Timestamp timestamp;
+    // Keys with an intent of the transaction, so that they can be resolved by anyone that finds the record.
+    set<int> intent_keys;
+};
+
+// State of a transaction kept by the node coordinating it (its gateway).
+struct Transaction {
+    long long id;
+    TransactionStatus status = PENDING;
+    // Timestamp at which the transaction reads.
+    Timestamp read_timestamp;
+    // Timestamp at which the transaction writes, which starts at the read timestamp and can be pushed above it (e.g.
+    // by a later read of one of its keys), in which case the reads are no longer valid at the commit timestamp.
+    Timestamp write_timestamp;
+    // First key written by the transaction, where its record lives (-1 if it hasn't written any).
+    int anchor_key = -1;
+    set<int> intent_keys;
+    set<int> read_keys;
+    // While every write falls in the same Range, writes are buffered by the coordinator instead of being sent, so that
+    // the transaction can still commit in one phase.
+    bool one_phase_commit = false;
+    // The transaction commits by writing a STAGING record at the same time as it proves its in-flight writes (and
+    // writes those still buffered, if it couldn't commit in one phase).
+    bool parallel_commit = false;
+    vector<Command> buffered_writes;
+    // Writes are answered as soon as they are proposed, and the keys of those that haven't been proven to be
+    // replicated yet are kept as in-flight writes.
+    bool write_pipelining = false;
+    set<int> in_flight_writes;
+    // Read-only transactions read every key at their read timestamp, which is fixed, and can't write.
+    bool read_only = false;
+};
+
+#endif //CRDB_REPLICATION_LAYER_TRANSACTION_H
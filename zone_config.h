@@ -0,0 +1,80 @@
+#include <bits/stdc++.h>
+#include "locality.h"
+
+using namespace std;
+
+#ifndef CRDB_REPLICATION_LAYER_ZONE_CONFIG_H
+#define CRDB_REPLICATION_LAYER_ZONE_CONFIG_H
+
+// A constraint on the locality of a node, e.g. region=us-east. Prohibited constraints (-region=us-east) match the nodes
+// that are not in that locality instead.
+struct Constraint {
+    // Either "region" or "zone".
+    string key;
+    string value;
+    bool prohibited = false;
+};
+
+bool Matches(const Locality &locality, const Constraint &constraint) {
+    const string &value = constraint.key == "region" ? locality.region : locality.zone;
+    return (value == constraint.value) != constraint.prohibited;
+}
+
+// Returns true if the locality matches every one of the constraints.
+bool SatisfiesConstraints(const Locality &locality, const vector<Constraint> &constraints) {
+    return all_of(constraints.begin(), constraints.end(),
+                  [&](const Constraint &constraint) { return Matches(locality, constraint); });
+}
+
+string ToString(const Constraint &constraint) {
+    return (constraint.prohibited ? "-" : "+") + constraint.key + "=" + constraint.value;
+}
+
+// How the Ranges of a span of keys are replicated.
+struct ZoneConfig {
+    int num_replicas = 3;
+    // How many of the replicas vote in Raft, the rest being non-voting replicas. 0 means that all of them vote.
+    int num_voters = 0;
+    // Every replica must be on a node that satisfies all of these constraints.
+    vector<Constraint> constraints;
+    // Voting replicas must also satisfy all of these constraints.
+    vector<Constraint> voter_constraints;
+    // Localities where the lease should be, in order of preference.
+    vector<Constraint> lease_preferences;
+    // How long overwritten values are kept around, in ticks.
+    long long gc_ttl = 50;
+};
+
+int NumVoters(const ZoneConfig &config) {
+    return config.num_voters > 0 ? config.num_voters : config.num_replicas;
+}
+
+// Constraints that the nodes of the voting replicas must satisfy.
+vector<Constraint> VoterConstraints(const ZoneConfig &config) {
+    auto constraints = config.constraints;
+    constraints.insert(constraints.end(), config.voter_constraints.begin(), config.voter_constraints.end());
+    return constraints;
+}
+
+void print_zone_config(int start, int end, const ZoneConfig &config) {
+    cout << "Zone config for [" << start << ", " << end << "]: num_replicas: " << config.num_replicas;
+    if (config.num_voters > 0) cout << ", num_voters: " << config.num_voters;
+    if (!config.constraints.empty()) {
+        cout << ", constraints: [ ";
+        for (const auto &constraint : config.constraints) cout << ToString(constraint) << " ";
+        cout << "]";
+    }
+    if (!config.voter_constraints.empty()) {
+        cout << ", voter_constraints: [ ";
+        for (const auto &constraint : config.voter_constraints) cout << ToString(constraint) << " ";
+        cout << "]";
+    }
+    if (!config.lease_preferences.empty()) {
+        cout << ", lease_preferences: [ ";
+        for (const auto &preference : config.lease_preferences) cout << ToString(preference) << " ";
+        cout << "]";
+    }
+    cout << ", gc_ttl: " << config.gc_ttl << endl;
+}
+
+#endif //CRDB_REPLICATION_LAYER_ZONE_CONFIG_H